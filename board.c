@@ -21,6 +21,7 @@
 
 #include "netris.h"
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef DEBUG_FALLING
 # define B_OLD
@@ -105,8 +106,10 @@ ExtFunc int RefreshBoard(int scr)
 					oldBoard[scr][y][x] = B_OLD(board[scr][y][x]);
 				}
 		}
-	if (robotEnable)
+	if (robotEnable) {
+		RobotPiece(scr);
 		RobotTimeStamp();
+	}
 	for (x = 0; x < boardWidth[scr]; ++x)
 		if (oldFalling[scr][x] != !!falling[scr][x]) {
 			oldFalling[scr][x] = !!falling[scr][x];
@@ -253,6 +256,34 @@ ExtFunc void InsertJunk(int scr, int count, int column)
 	curY[scr] += count;
 }
 
+/*
+ * Save the board and the falling piece, so guesses made on the
+ * opponent's board can be undone with RestoreBoard
+ */
+ExtFunc void SaveBoard(int scr, BoardState *state)
+{
+	memcpy(state->board, board[scr], sizeof(state->board));
+	state->shape = curShape[scr];
+	state->y = curY[scr];
+	state->x = curX[scr];
+}
+
+/*
+ * Only the blocks that differ are set, so only they're redrawn
+ */
+ExtFunc void RestoreBoard(int scr, BoardState *state)
+{
+	int y, x;
+
+	for (y = 0; y < boardHeight[scr]; ++y)
+		for (x = 0; x < boardWidth[scr]; ++x)
+			if (board[scr][y][x] != state->board[y][x])
+				SetBlock(scr, y, x, state->board[y][x]);
+	curShape[scr] = state->shape;
+	curY[scr] = state->y;
+	curX[scr] = state->x;
+}
+
 /*
  * vi: ts=4 ai
  * vim: noai si
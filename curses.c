@@ -290,9 +290,13 @@ ExtFunc void ShowDisplayInfo(void)
 
 	move(statusYPos - 9, statusXPos);
 	printw("Seed: %d", initSeed);
+	if (game == GT_classicTwo && roundTrip >= 0)
+		printw("  Clock: %+.1fms", clockOffset / 1000.0);
 	clrtoeol();
 	move(statusYPos - 8, statusXPos);
 	printw("Speed: %dms", speed / 1000);
+	if (game == GT_classicTwo && roundTrip >= 0)
+		printw("  Ping: %.1fms", roundTrip / 1000.0);
 	clrtoeol();
 	if (robotEnable) {
 		move(statusYPos - 7, statusXPos);
@@ -302,6 +306,12 @@ ExtFunc void ShowDisplayInfo(void)
 			addstr("Controlled by a robot");
 		clrtoeol();
 	}
+	if (netWrites) {
+		move(statusYPos - 10, statusXPos);
+		printw("Per write: %.1f pkts %.0fB",
+				netPackets / (double)netWrites, netBytes / (double)netWrites);
+		clrtoeol();
+	}
 	if (opponentFlags & SCF_usingRobot) {
 		move(statusYPos - 6, statusXPos);
 		if (opponentFlags & SCF_fairRobot)
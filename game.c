@@ -35,11 +35,17 @@ static char *keyNames[KT_numKeys+1] = {
 	"Left", "FullLeft","Rotate", "Right", "FullRight", "Drop", "Down", "ToggleSpy", "Pause",
 	"Faster", "Redraw", "New", NULL };
 
+/*
+ * Robots using protocol version 2 may send commands as numeric opcodes.
+ * Opcodes below KT_numKeys are the keys above, in the same order.
+ */
+#define RC_place	16	/* Rotate, move to a column and drop */
+
 static char *gameNames[GT_len] = { "OnePlayer", "ClassicTwo" };
 
 static char keyTable[KT_numKeys+1];
 static int dropModeEnable = 0;
-static char *robotProg;
+static char *robotProg, *replayFile;
 
 static int wonLast = 0;
 int lost = 0, won = 0;
@@ -93,29 +99,236 @@ ExtFunc int StartNewPiece(int scr, Shape *shape)
 	return 1;
 }
 
+/*
+ * Returns -1 if the piece couldn't reach its place, otherwise how far
+ * it was dropped
+ */
+static int PlacePiece(int scr, int rot, int x, int spied)
+{
+	int i, dir, count;
+
+	rot %= ShapeRotations(curShape[scr]);
+	for (i = 0; i < 3 && ShapeToRotation(curShape[scr]) != rot; ++i) {
+		if (!RotatePiece(scr))
+			return -1;
+		if (spied)
+			SendPacket(NP_rotate, 0, NULL);
+	}
+	while (curX[scr] != x) {
+		dir = x < curX[scr] ? -1 : 1;
+		if (!MovePiece(scr, 0, dir))
+			return -1;
+		if (spied)
+			SendPacket(dir < 0 ? NP_left : NP_right, 0, NULL);
+	}
+	if ((count = DropPiece(scr)) > 0 && spied)
+		SendPacket(NP_drop, 0, NULL);
+	return count;
+}
+
+/*
+ * With protocol version 4 the opponent is sent our inputs instead of
+ * what they did to our piece, and runs them on its copy of our board.
+ * The keys are the same numbers as KT_left to KT_down.  A fall is a
+ * step down by gravity, and a lock one that couldn't be made.  Falls
+ * are only counted, and sent as one IN_fall before the next input, or
+ * once they add up to FALL_DELAY.  Over UDP the junk we give goes with
+ * the inputs as IN_give.
+ */
+enum { IN_left, IN_fullLeft, IN_rotate, IN_right, IN_fullRight,
+	IN_drop, IN_down, IN_fall, IN_lock, IN_place, IN_piece, IN_junk,
+	IN_give };
+
+#define FALL_DELAY	600000	/* Microseconds */
+
+static unsigned char inputBuf[64 - sizeof(netint2[2])];
+static int inputSize, pendingFalls;
+static int remotePiece;		/* The opponent's piece is in play */
+static int udpInputs;		/* Inputs and junk go by UDP */
+
+/*
+ * Between their inputs the opponent's piece is moved down on our own
+ * ticks.  When more inputs arrive the guesses are undone, the inputs
+ * run from the last state they left, and the guesses not yet made up
+ * for by their falls are made again.
+ */
+static BoardState confirmed;
+static int predicted;
+
+static void PutInput(int type, int arg1, int arg2, int args)
+{
+	if (inputSize + 1 + args > sizeof(inputBuf)) {
+		SendPacket(NP_input, inputSize, inputBuf);
+		inputSize = 0;
+	}
+	inputBuf[inputSize++] = type;
+	if (args > 0)
+		inputBuf[inputSize++] = arg1;
+	if (args > 1)
+		inputBuf[inputSize++] = arg2;
+}
+
+static void AddInput(int type, int arg1, int arg2, int args)
+{
+	if (pendingFalls) {
+		PutInput(IN_fall, pendingFalls, 0, 1);
+		pendingFalls = 0;
+	}
+	PutInput(type, arg1, arg2, args);
+}
+
+static void AddFall(void)
+{
+	if (++pendingFalls == 255) {
+		PutInput(IN_fall, pendingFalls, 0, 1);
+		pendingFalls = 0;
+	}
+}
+
+/*
+ * Send the inputs so far, and the falls if there are enough of them
+ */
+static void SendInputs(void)
+{
+	if (pendingFalls && pendingFalls * speed >= FALL_DELAY) {
+		PutInput(IN_fall, pendingFalls, 0, 1);
+		pendingFalls = 0;
+	}
+	if (inputSize > 0) {
+		SendPacket(NP_input, inputSize, inputBuf);
+		inputSize = 0;
+	}
+}
+
+/*
+ * Run the opponent's inputs on scr, returning the lines they cleared,
+ * and adding up their falls and locks and the junk they gave us
+ */
+static int RunInputs(int scr, unsigned char *data, int size,
+		int *falls, int *given)
+{
+	int i, j, n, args, cleared = 0;
+
+	for (i = 0; i < size; i += 1 + args) {
+		n = data[i];
+		args = (n == IN_fall || n == IN_piece || n == IN_give)
+			+ 2 * (n == IN_place || n == IN_junk);
+		if (i + args >= size)
+			break;
+		if (n == IN_give) {
+			*given += data[i + 1];
+			continue;
+		}
+		if (!remotePiece && n != IN_piece && n != IN_junk)
+			continue;
+		switch (n) {
+			case IN_left:
+			case IN_right:
+				MovePiece(scr, 0, n == IN_left ? -1 : 1);
+				break;
+			case IN_fullLeft:
+			case IN_fullRight:
+				for (j = 0; j < MAX_BOARD_WIDTH; ++j)
+					MovePiece(scr, 0, n == IN_fullLeft ? -1 : 1);
+				break;
+			case IN_rotate:
+				RotatePiece(scr);
+				break;
+			case IN_drop:
+				DropPiece(scr);
+				break;
+			case IN_down:
+				MovePiece(scr, -1, 0);
+				break;
+			case IN_fall:
+				for (j = 0; j < data[i + 1]; ++j)
+					MovePiece(scr, -1, 0);
+				*falls += data[i + 1];
+				break;
+			case IN_lock:
+				++*falls;
+				FreezePiece(scr);
+				cleared += ClearFullLines(scr);
+				remotePiece = 0;
+				break;
+			case IN_place:
+				PlacePiece(scr, data[i + 1], data[i + 2] - 1, 0);
+				break;
+			case IN_piece:
+				if (!remotePiece)
+					remotePiece = StartNewPiece(scr,
+							NetNumToShape(data[i + 1]));
+				break;
+			case IN_junk:
+				if (data[i + 1] < boardHeight[scr])
+					InsertJunk(scr, data[i + 1], data[i + 2]);
+				break;
+		}
+	}
+	return cleared;
+}
+
+/*
+ * Undo the guesses on scr, run the opponent's new inputs and guess
+ * again.  Returns the lines they cleared.
+ */
+static int NewInputs(int scr, unsigned char *data, int size, int *given)
+{
+	int cleared, falls = 0;
+
+	if (predicted > 0)
+		RestoreBoard(scr, &confirmed);
+	cleared = RunInputs(scr, data, size, &falls, given);
+	SaveBoard(scr, &confirmed);
+	predicted = predicted > falls ? predicted - falls : 0;
+	if (remotePiece)
+		for (falls = 0; falls < predicted; ++falls)
+			MovePiece(scr, -1, 0);
+	return cleared;
+}
+
+static void TakeJunk(int scr, int count, int moves, int inputs)
+{
+	netint2 data[2];
+	short column;
+
+	column = Random(0, boardWidth[scr]);
+	InsertJunk(scr, count, column);
+	if (moves) {
+		data[0] = hton2(count);
+		data[1] = hton2(column);
+		SendPacket(NP_insertJunk, sizeof(data), data);
+	}
+	if (inputs)
+		AddInput(IN_junk, count, column, 2);
+}
+
 ExtFunc void OneGame(int scr, int scr2)
 {
 	MyEvent event;
 	int linesCleared, changed = 0;
-	int spied = 0, spying = 0, dropMode = 0;
+	int spying = 0, dropMode = 0;
+	int moves = 0, inputs = 0;	/* How the opponent is told what we do */
 	int oldPaused = 0, paused = 0, pausedByMe = 0, pausedByThem = 0;
 	long pauseTimeLeft;
-	int pieceCount = 0;
 	int key;
 	char *p, *cmd;
 
 	myLinesCleared = enemyLinesCleared = 0;
+	pieceCount = 0;
 	speed = stepDownInterval;
 	ResetBaseTime();
 	InitBoard(scr);
+	inputSize = pendingFalls = remotePiece = predicted = 0;
 	if (scr2 >= 0) {
-		spied = 1;
 		spying = 1;
+		inputs = protocolVersion >= 4;
+		moves = !inputs;
 		InitBoard(scr2);
 		UpdateOpponentDisplay();
 	}
 	ShowDisplayInfo();
-	SetITimer(speed, speed);
+	SetITimer(speed, speed + StartDelay());
 	if (robotEnable) {
 		RobotCmd(0, "GameType %s\n", gameNames[game]);
 		RobotCmd(0, "BoardSize 0 %d %d\n",
@@ -128,6 +341,9 @@ ExtFunc void OneGame(int scr, int scr2)
 				RobotCmd(0, "OpponentFlag 1 robot\n");
 			if (opponentFlags & SCF_fairRobot)
 				RobotCmd(0, "OpponentFlag 1 fairRobot\n");
+			if (roundTrip >= 0)
+				RobotCmd(0, "Latency 1 %.6f %.6f\n", roundTrip / 1.0e6,
+						clockOffset / 1.0e6);
 		}
 		RobotCmd(0, "TickLength %.3f\n", speed / 1.0e6);
 		RobotCmd(0, "BeginGame\n");
@@ -136,7 +352,7 @@ ExtFunc void OneGame(int scr, int scr2)
 	while (StartNewPiece(scr, ChooseOption(stdOptions))) {
 		if (robotEnable && !fairRobot)
 			RobotCmd(1, "NewPiece %d\n", ++pieceCount);
-		if (spied) {
+		if (moves) {
 			short shapeNum;
 			netint2 data[1];
 
@@ -144,6 +360,8 @@ ExtFunc void OneGame(int scr, int scr2)
 			data[0] = hton2(shapeNum);
 			SendPacket(NP_newPiece, sizeof(data), data);
 		}
+		if (inputs)
+			AddInput(IN_piece, ShapeToNetNum(curShape[scr]), 0, 1);
 		for (;;) {
 			changed = RefreshBoard(scr) || changed;
 			if (spying)
@@ -153,12 +371,23 @@ ExtFunc void OneGame(int scr, int scr2)
 				changed = 0;
 			}
 			CheckNetConn();
+			if (inputs)
+				SendInputs();
 			switch (WaitMyEvent(&event, EM_any)) {
 				case E_alarm:
-					if (!MovePiece(scr, -1, 0))
+					if (inputs && remotePiece) {
+						MovePiece(scr2, -1, 0);
+						++predicted;
+					}
+					if (!MovePiece(scr, -1, 0)) {
+						if (inputs)
+							AddInput(IN_lock, 0, 0, 0);
 						goto nextPiece;
-					else if (spied)
+					}
+					else if (moves)
 						SendPacket(NP_down, 0, NULL);
+					else if (inputs)
+						AddFall();
 					break;
 				case E_key:
 					p = strchr(keyTable, event.u.key);
@@ -174,37 +403,39 @@ ExtFunc void OneGame(int scr, int scr2)
 				keyEvent:
 					if (paused && (key != KT_pause) && (key != KT_redraw))
 						break;
+					if (inputs && key <= KT_down)
+						AddInput(key, 0, 0, 0);
 					switch(key) {
 						case KT_left:
-							if (MovePiece(scr, 0, -1) && spied)
+							if (MovePiece(scr, 0, -1) && moves)
 								SendPacket(NP_left, 0, NULL);
 							break;
 						case KT_full_left: {
 							int i = 0;
 							for(;i < MAX_BOARD_WIDTH; i++){
-								if (MovePiece(scr, 0, -1) && spied)
+								if (MovePiece(scr, 0, -1) && moves)
 									SendPacket(NP_left, 0, NULL);
 							}
 							break;
 						}
 						case KT_right:
-							if (MovePiece(scr, 0, 1) && spied)
+							if (MovePiece(scr, 0, 1) && moves)
 								SendPacket(NP_right, 0, NULL);
 							break;
 						case KT_full_right: {
 							int i = 0;
 							for(; i < MAX_BOARD_WIDTH; i++){
-								if (MovePiece(scr, 0, 1) && spied)
+								if (MovePiece(scr, 0, 1) && moves)
 									SendPacket(NP_right, 0, NULL);
 							}
 							break;
 						}
 						case KT_rotate:
-							if (RotatePiece(scr) && spied)
+							if (RotatePiece(scr) && moves)
 								SendPacket(NP_rotate, 0, NULL);
 							break;
 						case KT_down:
-							if (MovePiece(scr, -1, 0) && spied)
+							if (MovePiece(scr, -1, 0) && moves)
 								SendPacket(NP_down, 0, NULL);
 							break;
 						case KT_toggleSpy:
@@ -212,7 +443,7 @@ ExtFunc void OneGame(int scr, int scr2)
 							break;
 						case KT_drop:
 							if (DropPiece(scr) > 0) {
-								if (spied)
+								if (moves)
 									SendPacket(NP_drop, 0, NULL);
 								SetITimer(speed, speed);
 							}
@@ -238,6 +469,8 @@ ExtFunc void OneGame(int scr, int scr2)
 								break;
 							speed = speed * 0.8;
 							SetITimer(speed, SetITimer(0, 0));
+							if (robotEnable)
+								RobotCmd(1, "TickLength %.3f\n", speed / 1.0e6);
 							ShowDisplayInfo();
 							changed = 1;
 							break;
@@ -247,17 +480,42 @@ ExtFunc void OneGame(int scr, int scr2)
 								RefreshScreen();
 							break;
 					}
+					if (dropMode && inputs)
+						AddInput(IN_drop, 0, 0, 0);
 					if (dropMode && DropPiece(scr) > 0) {
-						if (spied)
+						if (moves)
 							SendPacket(NP_drop, 0, NULL);
 						SetITimer(speed, speed);
 					}
 					break;
 				case E_robot:
 				{
-					int num;
+					int num, op, rot, col, n;
 
 					cmd = event.u.robot.data;
+					if (robotVersion >= 2 && isdigit((unsigned char)cmd[0])) {
+						n = sscanf(cmd, "%d %d %d %d", &op, &num, &rot, &col);
+						if (n < 2 || op < 0 || !(fairRobot || num == pieceCount))
+							break;
+						if (op < KT_numKeys) {
+							key = op;
+							goto keyEvent;
+						}
+						if (op != RC_place || n < 4 || fairRobot || paused
+								|| rot < 0)
+							break;
+						rot %= 4;
+						col = col < -1 ? -1 : col > MAX_BOARD_WIDTH
+							? MAX_BOARD_WIDTH : col;
+						if (inputs)
+							AddInput(IN_place, rot, col + 1, 2);
+						if ((n = PlacePiece(scr, rot, col, moves)) >= 0) {
+							if (n > 0)
+								SetITimer(speed, speed);
+							dropMode = dropModeEnable;
+						}
+						break;
+					}
 					if ((p = strchr(cmd, ' ')))
 						*p++ = 0;
 					else
@@ -277,15 +535,10 @@ ExtFunc void OneGame(int scr, int scr2)
 					switch(event.u.net.type) {
 						case NP_giveJunk:
 						{
-							netint2 data[2];
-							short column;
-
-							memcpy(data, event.u.net.data, sizeof(data[0]));
-							column = Random(0, boardWidth[scr]);
-							data[1] = hton2(column);
-							InsertJunk(scr, ntoh2(data[0]), column);
-							if (spied)
-								SendPacket(NP_insertJunk, sizeof(data), data);
+							netint2 data[1];
+
+							memcpy(data, event.u.net.data, sizeof(data));
+							TakeJunk(scr, ntoh2(data[0]), moves, inputs);
 							break;
 						}
 						case NP_newPiece:
@@ -333,6 +586,34 @@ ExtFunc void OneGame(int scr, int scr2)
 							InsertJunk(scr2, ntoh2(data[0]), ntoh2(data[1]));
 							break;
 						}
+						case NP_input:
+						{
+							int cleared, given = 0;
+
+							cleared = NewInputs(scr2, event.u.net.data,
+									event.u.net.size, &given);
+							if (given)
+								TakeJunk(scr, given, moves, inputs);
+							if (cleared) {
+								enemyLinesCleared += cleared;
+								enemyTotalLinesCleared += cleared;
+								ShowDisplayInfo();
+								RefreshScreen();
+							}
+							break;
+						}
+						case NP_ping:
+							AnswerPing(event.u.net.data);
+							break;
+						case NP_pong:
+							if (!PongArrived(event.u.net.data))
+								break;
+							if (robotEnable)
+								RobotCmd(1, "Latency 1 %.6f %.6f\n",
+										roundTrip / 1.0e6, clockOffset / 1.0e6);
+							ShowDisplayInfo();
+							changed = 1;
+							break;
 						case NP_pause:
 						{
 							netint2 data[1];
@@ -351,6 +632,16 @@ ExtFunc void OneGame(int scr, int scr2)
 							break;
 					}
 					break;
+				case E_hostName:
+					for (p = opponentHost; *p; ++p)
+						if (!isprint((unsigned char)*p))
+							*p = '?';
+					if (robotEnable)
+						RobotCmd(1, "Opponent 1 %s %s\n", opponentName,
+								opponentHost);
+					UpdateOpponentDisplay();
+					changed = 1;
+					break;
 				case E_lostRobot:
 				case E_lostConn:
 					wonLast = 1;
@@ -375,7 +666,7 @@ ExtFunc void OneGame(int scr, int scr2)
 			ShowDisplayInfo();
 			RefreshScreen();
 		}
-		if (linesCleared > 0 && spied)
+		if (linesCleared > 0 && moves)
 			SendPacket(NP_clear, 0, NULL);
 		if (game == GT_classicTwo && linesCleared > 1) {
 			short junkLines;
@@ -383,7 +674,10 @@ ExtFunc void OneGame(int scr, int scr2)
 
 			junkLines = linesCleared - (linesCleared < 4);
 			data[0] = hton2(junkLines);
-			SendPacket(NP_giveJunk, sizeof(data), data);
+			if (udpInputs)
+				AddInput(IN_give, junkLines, 0, 1);
+			else
+				SendPacket(NP_giveJunk, sizeof(data), data);
 		}
 	}
 	wonLast = 0;
@@ -394,14 +688,14 @@ gameOver:
 
 ExtFunc int main(int argc, char **argv)
 {
-	int initConn = 0, waitConn = 0, ch, done = 0;
+	int initConn = 0, waitConn = 0, server = 0, ch, done = 0;
 	char *hostStr = NULL, *portStr = NULL;
 	MyEvent event;
 
 	standoutEnable = colorEnable = 1;
 	stepDownInterval = DEFAULT_INTERVAL;
 	MapKeys(DEFAULT_KEYS);
-	while ((ch = getopt(argc, argv, "hHRs:r:Fk:c:woDSCp:i:")) != -1)
+	while ((ch = getopt(argc, argv, "hHRs:r:Fk:c:woDSCp:i:l:b:ux:")) != -1)
 		switch (ch) {
 			case 'c':
 				initConn = 1;
@@ -425,6 +719,12 @@ ExtFunc int main(int argc, char **argv)
 				robotProg = optarg;
 				myFlags |= SCF_usingRobot;
 				break;
+			case 'l':
+				RecordRobot(optarg);
+				break;
+			case 'b':
+				replayFile = optarg;
+				break;
 			case 'F':
 				fairRobot = 1;
 				myFlags |= SCF_fairRobot;
@@ -432,6 +732,12 @@ ExtFunc int main(int argc, char **argv)
 			case 'D':
 				dropModeEnable = 1;
 				break;
+			case 'u':
+				myFlags |= SCF_udp;
+				break;
+			case 'x':
+				udpLoss = atoi(optarg);
+				break;
 			case 'C':
 				colorEnable = 0;
 				break;
@@ -460,6 +766,12 @@ ExtFunc int main(int argc, char **argv)
 	}
 	if (fairRobot && !robotEnable)
 		fatal("You can't use the -F option without the -r option");
+	if (replayFile) {
+		if (!robotEnable)
+			fatal("You can't use the -b option without the -r option");
+		InitUtil();
+		exit(ReplayRobot(robotProg, replayFile));
+	}
 	InitUtil();
 	InitScreens();
 	while(!done) {
@@ -479,6 +791,7 @@ ExtFunc int main(int argc, char **argv)
 				InitiateConnection(hostStr, portStr);
 			else if (waitConn)
 				WaitForConnection(portStr);
+			server = waitConn;
 			gameState = STATE_PLAYING;
 			ShowDisplayInfo();
 			RefreshScreen();
@@ -491,6 +804,35 @@ ExtFunc int main(int argc, char **argv)
 				SendPacket(NP_version, sizeof(data), data);
 				if (WaitMyEvent(&event, EM_net) != E_net)
 					fatal("Network negotiation failed");
+				if (event.u.net.type == NP_lobby) {
+					netint4 opts[3];
+
+					/* netrisd finds an opponent who agrees on these */
+					opts[0] = hton4(myFlags);
+					opts[1] = hton4(initSeed);
+					opts[2] = hton4(stepDownInterval);
+					SendPacket(NP_matchOpts, sizeof(opts), opts);
+					gameState = STATE_WAIT_CONNECTION;
+					ShowDisplayInfo();
+					RefreshScreen();
+					if (WaitMyEvent(&event, EM_net) != E_net
+							|| event.u.net.type != NP_relay)
+						fatal("Network negotiation failed");
+				}
+				if (event.u.net.type == NP_relay) {
+					netint2 role;
+
+					/* Our version is passed on, and theirs follows */
+					memcpy(&role, event.u.net.data, sizeof(role));
+					server = ntoh2(role);
+					SetNetRole(server);
+					myFlags &= ~SCF_udp;
+					gameState = STATE_PLAYING;
+					ShowDisplayInfo();
+					RefreshScreen();
+					if (WaitMyEvent(&event, EM_net) != E_net)
+						fatal("Network negotiation failed");
+				}
 				memcpy(data, event.u.net.data, sizeof(data));
 				major = ntoh4(data[0]);
 				protocolVersion = ntoh4(data[1]);
@@ -519,7 +861,7 @@ ExtFunc int main(int argc, char **argv)
 					seed = initSeed;
 				else
 					seed = time(0);
-				if (waitConn)
+				if (server)
 					SRandom(seed);
 				data[0] = hton4(myFlags);
 				data[1] = hton4(seed);
@@ -531,7 +873,7 @@ ExtFunc int main(int argc, char **argv)
 				memcpy(data, event.u.net.data, len);
 				opponentFlags = ntoh4(data[0]);
 				seed = ntoh4(data[1]);
-				if (initConn) {
+				if (!server) {
 					if ((opponentFlags & SCF_setSeed) != (myFlags & SCF_setSeed))
 						fatal("If one player sets the random number seed, "
 						      "both must.");
@@ -543,6 +885,10 @@ ExtFunc int main(int argc, char **argv)
 						      "interval (-i).\nYou must both use the same one.");
 					SRandom(seed);
 				}
+				udpInputs = protocolVersion >= 4
+					&& (myFlags & opponentFlags & SCF_udp);
+				if (udpInputs)
+					OpenUdp();
 			}
 			{
 				char *userName;
@@ -570,6 +916,8 @@ ExtFunc int main(int argc, char **argv)
 					if (!isprint(opponentHost[i]))
 						opponentHost[i] = '?';
 			}
+			if (protocolVersion >= 5)
+				SyncClocks();
 			OneGame(0, 1);
 		}
 		else {
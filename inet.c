@@ -25,145 +25,416 @@
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #define HEADER_SIZE sizeof(netint2[2])
+#define MAX_PACKET 64
+
+#define UDP_HEADER sizeof(netint4[2])
+#define MAX_DATAGRAM 1400
+#define RESEND_DELAY 50000	/* Microseconds */
+
+#define MIN_BACKOFF 250000	/* Microseconds between connection attempts */
+#define MAX_BACKOFF 8000000
+
+#define PING_INTERVAL 1000000	/* Microseconds */
+#define SYNC_PINGS 5			/* Sent before a game starts */
+#define START_MARGIN 20000		/* Microseconds added to the start delay */
 
 static MyEventType NetGenFunc(EventGenRec *gen, MyEvent *event);
+static MyEventType UdpGenFunc(EventGenRec *gen, MyEvent *event);
+static MyEventType ListenGenFunc(EventGenRec *gen, MyEvent *event);
+static MyEventType ConnectGenFunc(EventGenRec *gen, MyEvent *event);
+static MyEventType LookupGenFunc(EventGenRec *gen, MyEvent *event);
 
 static int sock = -1;
 static EventGenRec netGen = { NULL, 0, FT_read, -1, NetGenFunc, EM_net };
+static EventGenRec listenGen = { NULL, 0, FT_read, -1, ListenGenFunc, EM_net };
+static EventGenRec connGen = { NULL, 0, FT_write, -1, ConnectGenFunc, EM_net };
+static EventGenRec lookupGen =
+		{ NULL, 0, FT_read, -1, LookupGenFunc, EM_host };
+
+/* Setting up the connection */
+static struct sockaddr_storage peerAddr, hostAddr;
+static struct addrinfo *addrList, *nextAddr;
+static int refused, connErr;
+static long backoff;
+static pid_t lookupProcess = -1;
 
-static char netBuf[64];
-static int netBufSize, netBufGoal = HEADER_SIZE;
+/* Pings, and when the game is to start by NetClock */
+static unsigned int lastPing, startClock;
+static int bestTrip, haveStart;
+
+/* Bytes received, of which the first netBufStart have been handled */
+static char netBuf[4096];
+static int netBufSize, netBufStart;
+
+/* Packets queued since the event loop last waited, sent by FlushNet */
+static char outBuf[4096];
+static int outSize;
 static int isServer, lostConn, gotEndConn;
 
+/*
+ * With -u the NP_input packets go by UDP, as a stream of bytes.  Each
+ * datagram holds the offset of its first byte, how much of the other
+ * stream has arrived, and everything sent that hasn't been acknowledged
+ * yet, so a lost one is made up for by the next.  The inputs can get
+ * ahead of what's sent by TCP, so they have their own event mask, and
+ * only the game itself waits for them.
+ */
+static int udpSock = -1, udpHeard;
+static EventGenRec udpGen = { NULL, 0, FT_read, -1, UdpGenFunc, EM_udp };
+static unsigned char sendStream[MAX_DATAGRAM - UDP_HEADER];
+static unsigned long sendBase, received;
+static int sendSize, sendNew, ackDue;
+static long lastSend;
+
 ExtFunc void InitNet(void)
 {
 	lostConn = 0;
 	gotEndConn = 0;
+	sendBase = received = 0;
+	sendSize = sendNew = ackDue = udpHeard = 0;
+	roundTrip = -1;
+	clockOffset = 0;
+	haveStart = 0;
 	AtExit(CloseNet);
 }
 
-ExtFunc int WaitForConnection(char *portStr)
+/*
+ * The ports are given as strings, since that's what getaddrinfo wants
+ */
+static char *PortString(char *portStr)
+{
+	static char buf[16];
+
+	if (portStr)
+		return portStr;
+	sprintf(buf, "%d", DEFAULT_PORT);
+	return buf;
+}
+
+static void SetupSocket(int fd)
 {
-	struct sockaddr_in addr;
-	struct hostent *host;
-	int sockListen;
-	socklen_t addrLen;
-	short port;
 	int val1;
 	struct linger val2;
 
-	if (portStr)
-		port = atoi(portStr);	/* XXX Error checking */
-	else
-		port = DEFAULT_PORT;
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	addr.sin_port = htons(port);
-	sockListen = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockListen < 0)
-		die("socket");
+	if ((val1 = fcntl(fd, F_GETFL, 0)) < 0
+			|| fcntl(fd, F_SETFL, val1 & ~O_NONBLOCK) < 0)
+		die("fcntl");
+	if (isServer) {
+		val2.l_onoff = 1;
+		val2.l_linger = 0;
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&val2, sizeof(val2));
+	}
 	val1 = 1;
-	setsockopt(sockListen, SOL_SOCKET, SO_REUSEADDR,
-			(void *)&val1, sizeof(val1));
-	if (bind(sockListen, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-		die("bind");
-	if (listen(sockListen, 1) < 0)
-		die("listen");
-	addrLen = sizeof(addr);
-	sock = accept(sockListen, (struct sockaddr *)&addr, &addrLen);
-	if (sock < 0)
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&val1, sizeof(val1));
+	netGen.fd = sock = fd;
+	AddEventGen(&netGen);
+}
+
+static MyEventType ListenGenFunc(EventGenRec *gen, MyEvent *event)
+{
+	socklen_t addrLen = sizeof(peerAddr);
+
+	sock = accept(gen->fd, (struct sockaddr *)&peerAddr, &addrLen);
+	if (sock < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+			return E_none;
 		die("accept");
-	close(sockListen);
-	val2.l_onoff = 1;
-	val2.l_linger = 0;
-	setsockopt(sock, SOL_SOCKET, SO_LINGER,
-			(void *)&val2, sizeof(val2));
-	netGen.fd = sock;
-	strcpy(opponentHost, "???");
-	if (addr.sin_family == AF_INET) {
-		host = gethostbyaddr((void *)&addr.sin_addr,
-				sizeof(struct in_addr), AF_INET);
-		if (host) {
-			strncpy(opponentHost, host->h_name, sizeof(opponentHost)-1);
-			opponentHost[sizeof(opponentHost)-1] = 0;
+	}
+	return E_connect;
+}
+
+/*
+ * The opponent's host name is looked up by a child process, so the
+ * game can start without waiting for it.  Until it's known the address
+ * is shown instead.
+ */
+/*
+ * BSD wants the length of the address itself, not of the storage
+ */
+static socklen_t HostAddrLen(void)
+{
+	if (hostAddr.ss_family == AF_INET6)
+		return sizeof(struct sockaddr_in6);
+	return sizeof(struct sockaddr_in);
+}
+
+static void StartLookup(void)
+{
+	struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&peerAddr;
+	struct sockaddr_in *addr4 = (struct sockaddr_in *)&hostAddr;
+	char host[NI_MAXHOST];
+	int fds[2];
+
+	/* IPv4 clients of an IPv6 server are looked up as IPv4 */
+	memcpy(&hostAddr, &peerAddr, sizeof(hostAddr));
+	if (peerAddr.ss_family == AF_INET6
+			&& IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr)) {
+		memset(&hostAddr, 0, sizeof(hostAddr));
+		addr4->sin_family = AF_INET;
+		memcpy(&addr4->sin_addr, &addr6->sin6_addr.s6_addr[12],
+				sizeof(addr4->sin_addr));
+	}
+	if (getnameinfo((struct sockaddr *)&hostAddr, HostAddrLen(),
+			opponentHost, sizeof(opponentHost), NULL, 0, NI_NUMERICHOST))
+		strcpy(opponentHost, "???");
+	if (pipe(fds))
+		die("pipe");
+	lookupProcess = fork();
+	if (lookupProcess < 0)
+		die("fork");
+	if (lookupProcess == 0) {
+		close(fds[0]);
+		if (!getnameinfo((struct sockaddr *)&hostAddr, HostAddrLen(),
+				host, sizeof(host), NULL, 0, NI_NAMEREQD))
+			write(fds[1], host, strlen(host));
+		_exit(0);
+	}
+	close(fds[1]);
+	lookupGen.fd = fds[0];
+	AddEventGen(&lookupGen);
+}
+
+static MyEventType LookupGenFunc(EventGenRec *gen, MyEvent *event)
+{
+	int len;
+
+	len = read(gen->fd, opponentHost, sizeof(opponentHost) - 1);
+	if (len < 0 && errno == EINTR)
+		return E_none;
+	close(gen->fd);
+	gen->fd = -1;
+	if (len <= 0) {
+		/* No name, the address stays */
+		getnameinfo((struct sockaddr *)&hostAddr, HostAddrLen(),
+				opponentHost, sizeof(opponentHost), NULL, 0, NI_NUMERICHOST);
+		return E_none;
+	}
+	opponentHost[len] = 0;
+	return E_hostName;
+}
+
+/*
+ * Listen on IPv6 if there is such a thing, which takes IPv4 as well
+ */
+ExtFunc int WaitForConnection(char *portStr)
+{
+	struct addrinfo hints, *addrList, *ai;
+	int sockListen = -1, family, err, val1;
+	MyEvent event;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((err = getaddrinfo(NULL, PortString(portStr), &hints, &addrList))) {
+		fprintf(stderr, "Port %s: %s\n", PortString(portStr),
+				gai_strerror(err));
+		exit(1);
+	}
+	for (family = AF_INET6; sockListen < 0; family = AF_INET) {
+		for (ai = addrList; ai && sockListen < 0; ai = ai->ai_next) {
+			if (ai->ai_family != family)
+				continue;
+			sockListen = socket(ai->ai_family, ai->ai_socktype,
+					ai->ai_protocol);
+			if (sockListen < 0)
+				continue;
+			val1 = 1;
+			setsockopt(sockListen, SOL_SOCKET, SO_REUSEADDR,
+					(void *)&val1, sizeof(val1));
+#ifdef IPV6_V6ONLY
+			val1 = 0;
+			if (family == AF_INET6)
+				setsockopt(sockListen, IPPROTO_IPV6, IPV6_V6ONLY,
+						(void *)&val1, sizeof(val1));
+#endif
+			if (bind(sockListen, ai->ai_addr, ai->ai_addrlen) < 0) {
+				close(sockListen);
+				sockListen = -1;
+			}
 		}
+		if (family == AF_INET && sockListen < 0)
+			die("bind");
 	}
-	AddEventGen(&netGen);
+	freeaddrinfo(addrList);
+	if (listen(sockListen, 1) < 0)
+		die("listen");
 	isServer = 1;
+	listenGen.fd = sockListen;
+	AddEventGen(&listenGen);
+	while (sock < 0)
+		WaitMyEvent(&event, EM_net);
+	RemoveEventGen(&listenGen);
+	close(sockListen);
+	SetupSocket(sock);
+	StartLookup();
 	return 0;
 }
 
+/*
+ * Start connecting to the next address.  Once all of them have been
+ * refused they're tried again after a delay, which doubles each time.
+ */
+static void StartConnect(void)
+{
+	int fd, flags;
+
+	for (; nextAddr; nextAddr = nextAddr->ai_next) {
+		fd = socket(nextAddr->ai_family, nextAddr->ai_socktype,
+				nextAddr->ai_protocol);
+		if (fd < 0)
+			continue;
+		if ((flags = fcntl(fd, F_GETFL, 0)) < 0
+				|| fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+			die("fcntl");
+		if (!connect(fd, nextAddr->ai_addr, nextAddr->ai_addrlen))
+			connGen.ready = 1;
+		else if (errno != EINPROGRESS) {
+			connErr = errno;
+			refused |= errno == ECONNREFUSED;
+			close(fd);
+			continue;
+		}
+		connGen.fd = fd;
+		nextAddr = nextAddr->ai_next;
+		return;
+	}
+	if (!refused) {
+		errno = connErr;
+		die("connect");
+	}
+	nextAddr = addrList;
+	refused = 0;
+	SetITimer(0, backoff);
+	backoff = backoff * 2 > MAX_BACKOFF ? MAX_BACKOFF : backoff * 2;
+}
+
+static MyEventType ConnectGenFunc(EventGenRec *gen, MyEvent *event)
+{
+	int err;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(gen->fd, SOL_SOCKET, SO_ERROR, (void *)&err, &len) < 0)
+		err = errno;
+	if (!err) {
+		sock = gen->fd;
+		gen->fd = -1;
+		return E_connect;
+	}
+	close(gen->fd);
+	gen->fd = -1;
+	connErr = err;
+	refused |= err == ECONNREFUSED;
+	StartConnect();
+	return E_none;
+}
+
 ExtFunc int InitiateConnection(char *hostStr, char *portStr)
 {
-	struct sockaddr_in addr;
-	struct hostent *host;
-	short port;
-	int mySock;
+	struct addrinfo hints;
+	MyEvent event;
+	int err;
 
-	if (portStr)
-		port = atoi(portStr);	/* XXX Error checking */
-	else
-		port = DEFAULT_PORT;
-	host = gethostbyname(hostStr);
-	if (!host)
-		die("gethostbyname");
-	assert(host->h_addrtype == AF_INET);
-	strncpy(opponentHost, host->h_name, sizeof(opponentHost)-1);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_CANONNAME;
+	if ((err = getaddrinfo(hostStr, PortString(portStr), &hints, &addrList))) {
+		fprintf(stderr, "%s: %s\n", hostStr, gai_strerror(err));
+		exit(1);
+	}
+	strncpy(opponentHost, addrList->ai_canonname ? addrList->ai_canonname
+			: hostStr, sizeof(opponentHost)-1);
 	opponentHost[sizeof(opponentHost)-1] = 0;
- again:
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = host->h_addrtype;
-	memcpy(&addr.sin_addr, host->h_addr, host->h_length);
-	addr.sin_port = htons(port);
-	mySock = socket(AF_INET, SOCK_STREAM, 0);
-	if (mySock < 0)
-		die("socket");
-	if (connect(mySock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		if (errno != ECONNREFUSED)
-			die("connect");
-		close(mySock);
-		sleep(1);
-		goto again;
-	}
-	netGen.fd = sock = mySock;
-	AddEventGen(&netGen);
+	isServer = 0;
+	nextAddr = addrList;
+	refused = 0;
+	backoff = MIN_BACKOFF;
+	AddEventGen(&connGen);
+	StartConnect();
+	while (sock < 0)
+		if (WaitMyEvent(&event, EM_net | EM_alarm) == E_alarm)
+			StartConnect();
+	RemoveEventGen(&connGen);
+	SetITimer(0, 0);
+	freeaddrinfo(addrList);
+	SetupSocket(sock);
 	return 0;
 }
 
-static MyEventType NetGenFunc(EventGenRec *gen, MyEvent *event)
+/*
+ * Through netrisd, the relay says which end plays the server
+ */
+ExtFunc void SetNetRole(int server)
+{
+	isServer = server;
+}
+
+/*
+ * The size of the packet at the start of the unhandled bytes, or 0 if
+ * it hasn't all arrived
+ */
+static int NextPacket(void)
 {
-	int result;
-	short type, size;
+	short size;
 	netint2 data[2];
 
-	result = MyRead(sock, netBuf + netBufSize, netBufGoal - netBufSize);
-	if (result < 0) {
-		lostConn = 1;
-		return E_lostConn;
-	}
-	netBufSize += result;
-	if (netBufSize < netBufGoal)
-		return E_none;
-	memcpy(data, netBuf, sizeof(data));
-	type = ntoh2(data[0]);
+	if (netBufSize - netBufStart < HEADER_SIZE)
+		return 0;
+	memcpy(data, netBuf + netBufStart, sizeof(data));
 	size = ntoh2(data[1]);
-	if (size >= sizeof(netBuf))
+	if (size >= MAX_PACKET)
 		fatal("Received an invalid packet (too large), possibly an attempt\n"
 			  "  to exploit a vulnerability in versions before 0.52 !");
-	netBufGoal = size;
-	if (netBufSize < netBufGoal)
-		return E_none;
-	netBufSize = 0;
-	netBufGoal = HEADER_SIZE;
+	if (size < HEADER_SIZE)
+		fatal("Received an invalid packet (too small)");
+	return netBufSize - netBufStart < size ? 0 : size;
+}
+
+/*
+ * Read whatever has arrived and return the first packet.  If more
+ * complete packets are left, the generator is marked ready so they're
+ * handled before waiting in select again.
+ */
+static MyEventType NetGenFunc(EventGenRec *gen, MyEvent *event)
+{
+	int result, size;
+	short type;
+	netint2 data[2];
+	char *packet;
+
+	if (!(size = NextPacket())) {
+		memmove(netBuf, netBuf + netBufStart, netBufSize - netBufStart);
+		netBufSize -= netBufStart;
+		netBufStart = 0;
+		do
+			result = read(sock, netBuf + netBufSize,
+					sizeof(netBuf) - netBufSize);
+		while (result < 0 && errno == EINTR);
+		if (result <= 0) {
+			lostConn = 1;
+			return E_lostConn;
+		}
+		netBufSize += result;
+		if (!(size = NextPacket()))
+			return E_none;
+	}
+	packet = netBuf + netBufStart;
+	netBufStart += size;
+	if (NextPacket())
+		gen->ready = 1;
+	memcpy(data, packet, sizeof(data));
+	type = ntoh2(data[0]);
 	event->u.net.type = type;
 	event->u.net.size = size - HEADER_SIZE;
-	event->u.net.data = netBuf + HEADER_SIZE;
+	event->u.net.data = packet + HEADER_SIZE;
 	if (type == NP_endConn) {
 		gotEndConn = 1;
 		return E_lostConn;
@@ -175,20 +446,315 @@ static MyEventType NetGenFunc(EventGenRec *gen, MyEvent *event)
 	return E_net;
 }
 
+/*
+ * Start sending NP_input packets by UDP, on the port used by TCP.  The
+ * server doesn't know where the client's packets come from until the
+ * first one arrives, so the client keeps sending until it hears back.
+ */
+ExtFunc void OpenUdp(void)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+	int val1;
+
+	addrLen = sizeof(addr);
+	if ((isServer ? getsockname : getpeername)(sock,
+			(struct sockaddr *)&addr, &addrLen) < 0)
+		die("getsockname");
+	udpSock = socket(addr.ss_family, SOCK_DGRAM, 0);
+	if (udpSock < 0)
+		die("socket");
+	if (isServer) {
+		val1 = 1;
+		setsockopt(udpSock, SOL_SOCKET, SO_REUSEADDR,
+				(void *)&val1, sizeof(val1));
+#ifdef IPV6_V6ONLY
+		val1 = 0;
+		if (addr.ss_family == AF_INET6)
+			setsockopt(udpSock, IPPROTO_IPV6, IPV6_V6ONLY,
+					(void *)&val1, sizeof(val1));
+#endif
+		if (bind(udpSock, (struct sockaddr *)&addr, addrLen) < 0)
+			die("bind");
+	}
+	else if (connect(udpSock, (struct sockaddr *)&addr, addrLen) < 0)
+		die("connect");
+	udpGen.fd = udpSock;
+	AddEventGen(&udpGen);
+	lastSend = CurTimeval() - RESEND_DELAY;
+}
+
+static void SendDatagram(void)
+{
+	unsigned char packet[MAX_DATAGRAM];
+	netint4 header[2];
+	int size = UDP_HEADER + sendSize;
+
+	header[0] = hton4(sendBase);
+	header[1] = hton4(received);
+	memcpy(packet, header, UDP_HEADER);
+	memcpy(packet + UDP_HEADER, sendStream, sendSize);
+	lastSend = CurTimeval();
+	sendNew = ackDue = 0;
+	netBytes += size;
+	++netWrites;
+	if (udpLoss > 0 && rand() % 100 < udpLoss)
+		return;
+	/* Errors are like losses, the stream is sent again */
+	send(udpSock, packet, size, 0);
+}
+
+static int SameHost(struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+	if (a->ss_family == AF_INET6)
+		return !memcmp(&((struct sockaddr_in6 *)a)->sin6_addr,
+				&((struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+	return ((struct sockaddr_in *)a)->sin_addr.s_addr
+		== ((struct sockaddr_in *)b)->sin_addr.s_addr;
+}
+
+/*
+ * Returns the new part of the opponent's stream as an NP_input packet.
+ * It's always whole inputs, since each packet we're sent ends with one.
+ */
+static MyEventType UdpGenFunc(EventGenRec *gen, MyEvent *event)
+{
+	static unsigned char packet[MAX_DATAGRAM];
+	struct sockaddr_storage addr;
+	socklen_t addrLen = sizeof(addr);
+	netint4 header[2];
+	unsigned long base, ack;
+	int size;
+
+	size = recvfrom(udpSock, packet, sizeof(packet), 0,
+			(struct sockaddr *)&addr, &addrLen);
+	if (size < (int)UDP_HEADER)
+		return E_none;
+	if (!udpHeard) {
+		if (isServer) {
+			if (!SameHost(&addr, &peerAddr))
+				return E_none;
+			if (connect(udpSock, (struct sockaddr *)&addr, addrLen) < 0)
+				die("connect");
+		}
+		udpHeard = ackDue = 1;
+	}
+	memcpy(header, packet, UDP_HEADER);
+	base = (unsigned long)ntoh4(header[0]);
+	ack = (unsigned long)ntoh4(header[1]);
+	if (ack > sendBase && ack <= sendBase + sendSize) {
+		memmove(sendStream, sendStream + (ack - sendBase),
+				sendBase + sendSize - ack);
+		sendSize -= ack - sendBase;
+		sendBase = ack;
+	}
+	size -= UDP_HEADER;
+	if (size > 0)
+		ackDue = 1;
+	if (base > received || base + size <= received)
+		return E_none;
+	event->u.net.type = NP_input;
+	event->u.net.size = base + size - received;
+	event->u.net.data = packet + UDP_HEADER + (received - base);
+	received = base + size;
+	return E_net;
+}
+
+/*
+ * A ping carries our clock, and the pong sends it back along with the
+ * opponent's.  Half the round trip is taken as the time the pong took,
+ * which is only right if the way back is as fast as the way there, so
+ * the offset between the clocks is taken from the fastest round trips.
+ */
+ExtFunc void SendPing(void)
+{
+	netint4 data[1];
+
+	lastPing = NetClock();
+	data[0] = hton4(lastPing);
+	SendPacket(NP_ping, sizeof(data), data);
+}
+
+ExtFunc void AnswerPing(void *ping)
+{
+	netint4 data[2];
+
+	memcpy(data, ping, sizeof(data[0]));
+	data[1] = hton4(NetClock());
+	SendPacket(NP_pong, sizeof(data), data);
+}
+
+/*
+ * Returns whether roundTrip and clockOffset changed
+ */
+ExtFunc int PongArrived(void *pong)
+{
+	netint4 data[2];
+	unsigned int sent;
+	int trip, offset;
+
+	memcpy(data, pong, sizeof(data));
+	sent = ntoh4(data[0]);
+	trip = ClockDiff(NetClock(), sent);
+	if (trip < 0)
+		return 0;
+	offset = ClockDiff(ntoh4(data[1]), sent) - trip / 2;
+	if (roundTrip < 0) {
+		roundTrip = bestTrip = trip;
+		clockOffset = offset;
+		return 1;
+	}
+	roundTrip = (7 * roundTrip + trip) / 8;
+	if (trip < bestTrip)
+		bestTrip = trip;
+	else
+		bestTrip += (trip - bestTrip) / 16;
+	if (trip <= bestTrip + bestTrip / 2)
+		clockOffset = (3 * clockOffset + offset) / 4;
+	return 1;
+}
+
+/*
+ * Before a game, the client measures the round trip and tells the
+ * server when to start, on the server's clock.  The delay is long
+ * enough for that to arrive.  Both then start their timers at that
+ * moment, see StartDelay.
+ */
+ExtFunc void SyncClocks(void)
+{
+	MyEvent event;
+	netint4 data[3];
+	int i;
+
+	if (isServer) {
+		for (;;) {
+			if (WaitMyEvent(&event, EM_net) != E_net)
+				fatal("Network negotiation failed");
+			if (event.u.net.type == NP_startAt)
+				break;
+			if (event.u.net.type != NP_ping)
+				fatal("Network negotiation failed");
+			AnswerPing(event.u.net.data);
+		}
+		memcpy(data, event.u.net.data, sizeof(data));
+		startClock = ntoh4(data[0]);
+		roundTrip = bestTrip = ntoh4(data[1]);
+		clockOffset = -(int)ntoh4(data[2]);
+	}
+	else {
+		for (i = 0; i < SYNC_PINGS; ++i) {
+			SendPing();
+			if (WaitMyEvent(&event, EM_net) != E_net
+					|| event.u.net.type != NP_pong)
+				fatal("Network negotiation failed");
+			PongArrived(event.u.net.data);
+		}
+		startClock = NetClock() + roundTrip + START_MARGIN;
+		data[0] = hton4(startClock + clockOffset);
+		data[1] = hton4(roundTrip);
+		data[2] = hton4(clockOffset);
+		SendPacket(NP_startAt, sizeof(data), data);
+	}
+	lastPing = NetClock();
+	haveStart = 1;
+}
+
+/*
+ * How long to wait before the first tick of a game, so both players
+ * start together
+ */
+ExtFunc long StartDelay(void)
+{
+	int delay;
+
+	if (!haveStart)
+		return 0;
+	haveStart = 0;
+	delay = ClockDiff(startClock, NetClock());
+	return delay > 0 ? delay : 0;
+}
+
 ExtFunc void CheckNetConn(void)
 {
+	if (sock >= 0 && protocolVersion >= 5
+			&& ClockDiff(NetClock(), lastPing) >= PING_INTERVAL)
+		SendPing();
 }
 
+/*
+ * Queue a packet.  Nagle is off, so the packets queued by one turn of
+ * the event loop go out together when it next waits.
+ */
 ExtFunc void SendPacket(NetPacketType type, int size, void *data)
 {
 	netint2 header[2];
 
+	if (type == NP_input && udpSock >= 0) {
+		if (sendSize + size > sizeof(sendStream))
+			fatal("Your opponent stopped acknowledging UDP packets");
+		memcpy(sendStream + sendSize, data, size);
+		sendSize += size;
+		sendNew = 1;
+		++netPackets;
+		return;
+	}
+	if (outSize + HEADER_SIZE + size > sizeof(outBuf))
+		FlushNet();
 	header[0] = hton2(type);
 	header[1] = hton2(size + HEADER_SIZE);
-	if (MyWrite(sock, header, HEADER_SIZE) != HEADER_SIZE)
-		die("write");
-	if (size > 0 && data && MyWrite(sock, data, size) != size)
+	memcpy(outBuf + outSize, header, HEADER_SIZE);
+	outSize += HEADER_SIZE;
+	if (size > 0 && data) {
+		memcpy(outBuf + outSize, data, size);
+		outSize += size;
+	}
+	++netPackets;
+}
+
+/*
+ * UDP is sent when there are new inputs or an acknowledgement is due,
+ * and sent again while anything hasn't been acknowledged.  The time is
+ * compared unsigned since the base time is reset when a game starts.
+ */
+/*
+ * Microseconds until FlushUdp has something to send, or -1 if it only
+ * waits for new inputs.  The event loop waits no longer than this, so
+ * a lost datagram is sent again on time.
+ */
+ExtFunc long UdpTimeout(void)
+{
+	long left;
+
+	if (udpSock < 0 || !(udpHeard || !isServer))
+		return -1;
+	if (sendNew || ackDue)
+		return 0;
+	if (!(sendSize || !udpHeard))
+		return -1;
+	left = RESEND_DELAY - (CurTimeval() - lastSend);
+	if (left < 0 || left > RESEND_DELAY)
+		return 0;
+	return left;
+}
+
+ExtFunc void FlushUdp(void)
+{
+	if (UdpTimeout() == 0)
+		SendDatagram();
+}
+
+ExtFunc void FlushNet(void)
+{
+	FlushUdp();
+	if (outSize == 0 || sock < 0)
+		return;
+	if (MyWrite(sock, outBuf, outSize) != outSize)
 		die("write");
+	netBytes += outSize;
+	++netWrites;
+	outSize = 0;
 }
 
 ExtFunc void CloseNet(void)
@@ -206,6 +772,7 @@ ExtFunc void CloseNet(void)
 				while (!gotEndConn)
 					WaitMyEvent(&event, EM_net);
 				SendPacket(NP_byeBye, 0, NULL);
+				FlushNet();
 			}
 		}
 		close(sock);
@@ -213,6 +780,23 @@ ExtFunc void CloseNet(void)
 	}
 	if (netGen.next)
 		RemoveEventGen(&netGen);
+	if (udpSock >= 0) {
+		close(udpSock);
+		udpSock = -1;
+	}
+	if (udpGen.next)
+		RemoveEventGen(&udpGen);
+	if (lookupProcess > 0) {
+		kill(lookupProcess, SIGKILL);
+		waitpid(lookupProcess, NULL, 0);
+		lookupProcess = -1;
+	}
+	if (lookupGen.fd >= 0) {
+		close(lookupGen.fd);
+		lookupGen.fd = -1;
+	}
+	if (lookupGen.next)
+		RemoveEventGen(&lookupGen);
 }
 
 /*
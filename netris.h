@@ -63,31 +63,38 @@ typedef long netint4;
 #define ntoh2(x) ntohs(x)
 #define ntoh4(x) ntohl(x)
 
+/* The difference between two times from NetClock, which wraps around */
+#define ClockDiff(a, b)	((int)((unsigned int)(a) - (unsigned int)(b)))
+
 #define DEFAULT_PORT 9284	/* Very arbitrary */
 
 #define DEFAULT_KEYS "jJklL mspf^ln "
 
 /* Protocol versions */
 #define MAJOR_VERSION		1	
-#define PROTOCOL_VERSION	3
-#define ROBOT_VERSION		1
+#define PROTOCOL_VERSION	5
+#define ROBOT_VERSION		2
 
 #define MAX_BOARD_WIDTH		32
 #define MAX_BOARD_HEIGHT	64
 #define MAX_SCREENS			2
 
 #define DEFAULT_INTERVAL	300000	/* Step-down interval in microseconds */
+#define REPLAY_TIMEOUT		2000000	/* Wait for a replayed robot reply */
 
 /* NP_startConn flags */
 #define SCF_usingRobot		000001
 #define SCF_fairRobot		000002
 #define SCF_setSeed			000004
+#define SCF_udp				000010
 
 /* Event masks */
 #define EM_alarm			000001
 #define EM_key				000002
 #define EM_net				000004
 #define EM_robot			000010
+#define EM_host				000020
+#define EM_udp				000040
 #define EM_any				000777
 
 typedef enum _GameType { GT_onePlayer, GT_classicTwo, GT_len } GameType;
@@ -98,13 +105,16 @@ typedef enum _Dir { D_down, D_right, D_up, D_left } Dir;
 typedef enum _Cmd { C_end, C_forw, C_back, C_left, C_right, C_plot } Cmd;
 typedef enum _FDType { FT_read, FT_write, FT_except, FT_len } FDType;
 typedef enum _MyEventType { E_none, E_alarm, E_key, E_net,
-							E_lostConn, E_robot, E_lostRobot } MyEventType;
+							E_lostConn, E_robot, E_lostRobot,
+							E_connect, E_hostName } MyEventType;
 typedef enum _NetPacketType { NP_endConn, NP_giveJunk, NP_newPiece,
 							NP_down, NP_left, NP_right,
 							NP_rotate, NP_drop, NP_clear,
 							NP_insertJunk, NP_startConn,
 							NP_userName, NP_pause, NP_version,
-							NP_byeBye } NetPacketType;
+							NP_byeBye, NP_input, NP_ping,
+							NP_pong, NP_startAt, NP_relay,
+							NP_lobby, NP_matchOpts } NetPacketType;
 
 typedef signed char BlockType;
 
@@ -144,6 +154,13 @@ typedef struct _Shape {
 	Cmd *cmds;
 } Shape;
 
+/* A copy of a board and its falling piece, see SaveBoard */
+typedef struct _BoardState {
+	BlockType board[MAX_BOARD_HEIGHT][MAX_BOARD_WIDTH];
+	Shape *shape;
+	int y, x;
+} BoardState;
+
 typedef struct _ShapeOption {
 	float weight;
 	Shape *shape;
@@ -167,6 +184,7 @@ EXT int curY[MAX_SCREENS], curX[MAX_SCREENS];
 EXT char opponentName[16], opponentHost[256];
 EXT int standoutEnable, colorEnable;
 EXT int robotEnable, robotVersion, fairRobot;
+EXT int pieceCount;
 EXT int protocolVersion;
 
 EXT long initSeed;
@@ -182,6 +200,10 @@ EXT char scratch[1024];
 extern ShapeOption stdOptions[];
 extern char *version_string;
 
+EXT long netPackets, netBytes, netWrites;	/* Sent to the opponent */
+EXT int udpLoss;	/* Percentage of UDP packets dropped, for testing */
+EXT long roundTrip, clockOffset;	/* In microseconds, from pings */
+
 EXT int myLinesCleared;
 EXT int enemyLinesCleared;
 EXT int myTotalLinesCleared;
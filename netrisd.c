@@ -0,0 +1,599 @@
+/*
+ * netrisd -- Matches up Netris players and relays their games
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+/*
+ * Players connect with "netris -c <host>".  netrisd answers their
+ * NP_version with NP_lobby, and they reply with NP_matchOpts: the
+ * options that both players of a game must agree on.  Players with the
+ * same options are paired in the order they arrive.  Each gets an
+ * NP_relay packet saying whether it plays the part of "netris -w",
+ * then its opponent's NP_version, and from then on whatever one sends
+ * is passed on to the other.  All the matches are run by one epoll
+ * loop.
+ */
+
+#define _GNU_SOURCE		/* For accept4 */
+#include "netris.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#define HEADER_SIZE sizeof(netint2[2])
+#define BUF_SIZE 8192		/* Bytes waiting to go to each player */
+#define HELLO_SIZE 64		/* Room for NP_version and NP_matchOpts */
+#define HASH_SIZE 16384		/* Lobby buckets, a power of two */
+#define HELLO_TIMEOUT 30	/* Seconds to send NP_version and NP_matchOpts */
+#define MAX_EVENTS 256
+
+enum { CS_version, CS_options, CS_queued, CS_playing };
+
+/*
+ * A connection to a player.  Until it's paired, in holds what it has
+ * sent.  Afterwards, the bytes from its opponent are kept in out until
+ * they can be written; while out is full the opponent isn't read from.
+ */
+typedef struct _Conn {
+	int fd, events, state;
+	struct _Conn *peer;		/* NULL until paired */
+	struct _Conn *next, **prev;	/* In hellos, its lobby bucket or freeList */
+	int closing;			/* Close once out has been written */
+	long interval, seed;	/* What it must be paired by */
+	int setSeed;
+	unsigned int queuedAt;
+	time_t connectedAt;
+	int versionSize, inSize;
+	char in[HELLO_SIZE];
+	int outSize;
+	char *out;				/* BUF_SIZE bytes once it's paired */
+} Conn;
+
+static int epollFd, listenFd, listenPaused;
+static Conn *lobby[HASH_SIZE];	/* Players waiting for an opponent */
+static Conn *hellos, **lastHello = &hellos;	/* Oldest first */
+static Conn *freeList;			/* Closed during this turn of the loop */
+static long matches, totalMatches, conns, queued;
+static long paired, maxWait;	/* Since the last statistics */
+static double totalWait, bytesRelayed;
+
+static void ShowUsage(void)
+{
+	fprintf(stderr,
+	  "Usage: netrisd <options>\n"
+	  "  -h		Print usage information\n"
+	  "  -p <port>	Set port number (default is %d)\n"
+	  "  -s <sec>	Print statistics this often\n"
+	  "		(waits are how long players were queued)\n",
+	  DEFAULT_PORT);
+}
+
+static void SysError(char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+/*
+ * Ask epoll for what the connection can use now
+ */
+static void Update(Conn *c)
+{
+	struct epoll_event ev;
+	int events;
+
+	if (c->closing)
+		events = c->outSize > 0 ? EPOLLOUT : 0;
+	else if (c->state == CS_queued)
+		events = EPOLLRDHUP;
+	else if (!c->peer)
+		events = EPOLLIN;
+	else
+		events = (c->peer->outSize < BUF_SIZE ? EPOLLIN : 0)
+			| (c->outSize > 0 ? EPOLLOUT : 0);
+	if (events == c->events)
+		return;
+	ev.events = c->events = events;
+	ev.data.ptr = c;
+	if (epoll_ctl(epollFd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+		SysError("epoll_ctl");
+}
+
+/*
+ * Same as NetClock in netris, in microseconds
+ */
+static unsigned int Clock(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned int)tv.tv_sec * 1000000U + tv.tv_usec;
+}
+
+static Conn **Bucket(Conn *c)
+{
+	unsigned long hash;
+
+	hash = c->interval * 31 + c->setSeed;
+	if (c->setSeed)
+		hash = hash * 31 + c->seed;
+	return &lobby[(hash ^ hash >> 14) & (HASH_SIZE - 1)];
+}
+
+static void Unqueue(Conn *c)
+{
+	if ((*c->prev = c->next))
+		c->next->prev = c->prev;
+	c->prev = NULL;
+	c->state = CS_playing;
+	--queued;
+}
+
+/*
+ * While out of descriptors, the listener is left out of epoll, or it
+ * would be ready again straight away
+ */
+static void PauseListen(int pause)
+{
+	struct epoll_event ev;
+
+	if (pause == listenPaused)
+		return;
+	listenPaused = pause;
+	ev.events = pause ? 0 : EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epollFd, EPOLL_CTL_MOD, listenFd, &ev) < 0)
+		SysError("epoll_ctl");
+}
+
+/*
+ * Until it has sent its options, a connection is in hellos, so that it
+ * can be dropped if it takes too long
+ */
+static void AddHello(Conn *c)
+{
+	c->connectedAt = time(0);
+	c->next = NULL;
+	c->prev = lastHello;
+	*lastHello = c;
+	lastHello = &c->next;
+}
+
+static void RemoveHello(Conn *c)
+{
+	if (!c->prev)
+		return;
+	if ((*c->prev = c->next))
+		c->next->prev = c->prev;
+	else
+		lastHello = c->prev;
+	c->prev = NULL;
+}
+
+/*
+ * The memory isn't reused until the events already returned have been
+ * handled
+ */
+static void CloseConn(Conn *c)
+{
+	if (c->fd < 0)
+		return;
+	if (c->state == CS_queued)
+		Unqueue(c);
+	else
+		RemoveHello(c);
+	close(c->fd);
+	c->fd = -1;
+	c->next = freeList;
+	freeList = c;
+	--conns;
+	PauseListen(0);
+}
+
+/*
+ * When one player goes, the other gets what was sent before it's
+ * disconnected too
+ */
+static void EndMatch(Conn *c)
+{
+	Conn *peer = c->peer;
+
+	CloseConn(c);
+	if (peer && peer->fd >= 0) {
+		--matches;
+		peer->peer = NULL;
+		peer->closing = 1;
+		if (peer->outSize == 0)
+			CloseConn(peer);
+		else
+			Update(peer);
+	}
+}
+
+static void WriteConn(Conn *c)
+{
+	int result;
+
+	result = write(c->fd, c->out, c->outSize);
+	if (result < 0 && errno != EAGAIN && errno != EINTR) {
+		EndMatch(c);
+		return;
+	}
+	if (result > 0) {
+		memmove(c->out, c->out + result, c->outSize - result);
+		c->outSize -= result;
+	}
+	if (c->closing && c->outSize == 0) {
+		CloseConn(c);
+		return;
+	}
+	/* Wait for room to write, and stop reading its opponent when full */
+	Update(c);
+	if (c->peer)
+		Update(c->peer);
+}
+
+static void ReadConn(Conn *c)
+{
+	Conn *peer = c->peer;
+	int result;
+
+	if (peer->outSize == BUF_SIZE)
+		return;
+	result = read(c->fd, peer->out + peer->outSize,
+			BUF_SIZE - peer->outSize);
+	if (result < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (result <= 0) {
+		EndMatch(c);
+		return;
+	}
+	peer->outSize += result;
+	bytesRelayed += result;
+	WriteConn(peer);
+}
+
+static void PutPacket(Conn *c, NetPacketType type, int size, void *data)
+{
+	netint2 header[2];
+
+	header[0] = hton2(type);
+	header[1] = hton2(size + HEADER_SIZE);
+	memcpy(c->out + c->outSize, header, HEADER_SIZE);
+	memcpy(c->out + c->outSize + HEADER_SIZE, data, size);
+	c->outSize += HEADER_SIZE + size;
+}
+
+/*
+ * The first to arrive waits for a connection, as with "netris -w".
+ * Each gets the other's NP_version, which netrisd has kept.
+ */
+static void Pair(Conn *a, Conn *b)
+{
+	netint2 data[1];
+	unsigned int wait;
+
+	if (!(a->out = malloc(BUF_SIZE)) || !(b->out = malloc(BUF_SIZE))) {
+		CloseConn(a);
+		CloseConn(b);
+		return;
+	}
+	wait = Clock() - a->queuedAt;
+	totalWait += wait;
+	if (wait > maxWait)
+		maxWait = wait;
+	++paired;
+	Unqueue(a);
+	b->state = CS_playing;
+	a->peer = b;
+	b->peer = a;
+	data[0] = hton2(1);
+	PutPacket(a, NP_relay, sizeof(data), data);
+	data[0] = hton2(0);
+	PutPacket(b, NP_relay, sizeof(data), data);
+	memcpy(a->out + a->outSize, b->in, b->inSize);
+	a->outSize += b->inSize;
+	memcpy(b->out + b->outSize, a->in, a->inSize);
+	b->outSize += a->inSize;
+	++matches;
+	++totalMatches;
+	WriteConn(a);
+	if (b->fd >= 0)
+		WriteConn(b);
+}
+
+/*
+ * Pair with the longest waiting player who has the same options, or
+ * wait for one
+ */
+static void Queue(Conn *c)
+{
+	Conn **bucket, *other;
+
+	bucket = Bucket(c);
+	for (other = *bucket; other; other = other->next)
+		if (other->interval == c->interval && other->setSeed == c->setSeed
+				&& (!c->setSeed || other->seed == c->seed)) {
+			Pair(other, c);
+			return;
+		}
+	c->state = CS_queued;
+	c->queuedAt = Clock();
+	/* At the end, so the oldest is found first */
+	for (; *bucket; bucket = &(*bucket)->next)
+		;
+	c->next = NULL;
+	c->prev = bucket;
+	*bucket = c;
+	++queued;
+	Update(c);
+}
+
+/*
+ * Handle NP_version or NP_matchOpts if it has all arrived.  The size of
+ * NP_version depends on the client's netint4, so it's taken from the
+ * header.  Returns 0 if there's nothing more to do.
+ */
+static int HelloPacket(Conn *c)
+{
+	netint2 header[2];
+	netint4 data[3];
+	int size, start;
+
+	start = c->state == CS_version ? 0 : c->versionSize;
+	if (c->inSize - start < HEADER_SIZE)
+		return 0;
+	memcpy(header, c->in + start, HEADER_SIZE);
+	size = ntoh2(header[1]);
+	if (size < HEADER_SIZE || start + size > HELLO_SIZE) {
+		CloseConn(c);
+		return 0;
+	}
+	if (c->inSize - start < size)
+		return 0;
+	if (c->state == CS_version) {
+		if (ntoh2(header[0]) != NP_version) {
+			CloseConn(c);
+			return 0;
+		}
+		c->versionSize = size;
+		c->state = CS_options;
+		header[0] = hton2(NP_lobby);
+		header[1] = hton2(HEADER_SIZE);
+		if (write(c->fd, header, HEADER_SIZE) != HEADER_SIZE) {
+			CloseConn(c);
+			return 0;
+		}
+		return 1;
+	}
+	if (ntoh2(header[0]) != NP_matchOpts || size != HEADER_SIZE + sizeof(data)
+			|| c->inSize != start + size) {
+		CloseConn(c);
+		return 0;
+	}
+	memcpy(data, c->in + start + HEADER_SIZE, sizeof(data));
+	c->setSeed = (ntoh4(data[0]) & SCF_setSeed) != 0;
+	c->seed = ntoh4(data[1]);
+	c->interval = ntoh4(data[2]);
+	/* The options were for netrisd; the opponent gets the version */
+	c->inSize = c->versionSize;
+	RemoveHello(c);
+	Queue(c);
+	return 0;
+}
+
+static void ReadHello(Conn *c)
+{
+	int result;
+
+	result = read(c->fd, c->in + c->inSize, HELLO_SIZE - c->inSize);
+	if (result < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (result <= 0) {
+		CloseConn(c);
+		return;
+	}
+	c->inSize += result;
+	while (HelloPacket(c))
+		;
+}
+
+static void AcceptConns(void)
+{
+	struct epoll_event ev;
+	Conn *c;
+	int fd, val1 = 1;
+
+	while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&val1, sizeof(val1));
+		if (!(c = calloc(1, sizeof(*c)))) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		ev.events = c->events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+			SysError("epoll_ctl");
+		c->state = CS_version;
+		AddHello(c);
+		++conns;
+	}
+	if (errno == EMFILE || errno == ENFILE)
+		PauseListen(1);
+	else if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+		SysError("accept");
+}
+
+/*
+ * Listen on IPv6 if there is such a thing, which takes IPv4 as well
+ */
+static void Listen(char *portStr)
+{
+	struct addrinfo hints, *addrList, *ai;
+	int family, err, val1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((err = getaddrinfo(NULL, portStr, &hints, &addrList))) {
+		fprintf(stderr, "Port %s: %s\n", portStr, gai_strerror(err));
+		exit(1);
+	}
+	listenFd = -1;
+	for (family = AF_INET6; listenFd < 0; family = AF_INET) {
+		for (ai = addrList; ai && listenFd < 0; ai = ai->ai_next) {
+			if (ai->ai_family != family)
+				continue;
+			listenFd = socket(ai->ai_family,
+					ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+			if (listenFd < 0)
+				continue;
+			val1 = 1;
+			setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR,
+					(void *)&val1, sizeof(val1));
+#ifdef IPV6_V6ONLY
+			val1 = 0;
+			if (family == AF_INET6)
+				setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY,
+						(void *)&val1, sizeof(val1));
+#endif
+			if (bind(listenFd, ai->ai_addr, ai->ai_addrlen) < 0) {
+				close(listenFd);
+				listenFd = -1;
+			}
+		}
+		if (family == AF_INET && listenFd < 0)
+			SysError("bind");
+	}
+	freeaddrinfo(addrList);
+	if (listen(listenFd, SOMAXCONN) < 0)
+		SysError("listen");
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct rlimit limit;
+	char portStr[16], *port = NULL;
+	int ch, i, n, statInterval = 0;
+	long lastStats;
+	Conn *c;
+
+	while ((ch = getopt(argc, argv, "hp:s:")) != -1)
+		switch (ch) {
+			case 'p':
+				port = optarg;
+				break;
+			case 's':
+				statInterval = atoi(optarg);
+				break;
+			case 'h':
+				ShowUsage();
+				exit(0);
+			default:
+				ShowUsage();
+				exit(1);
+		}
+	if (optind < argc) {
+		ShowUsage();
+		exit(1);
+	}
+	if (!port) {
+		sprintf(portStr, "%d", DEFAULT_PORT);
+		port = portStr;
+	}
+	/* Each match takes two descriptors */
+	if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	Listen(port);
+	if ((epollFd = epoll_create1(0)) < 0)
+		SysError("epoll_create1");
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) < 0)
+		SysError("epoll_ctl");
+	lastStats = time(0);
+	for (;;) {
+		n = epoll_wait(epollFd, events, MAX_EVENTS,
+				statInterval || hellos ? 1000 : -1);
+		if (n < 0 && errno != EINTR)
+			SysError("epoll_wait");
+		for (i = 0; i < n; ++i) {
+			if (!(c = events[i].data.ptr)) {
+				AcceptConns();
+				continue;
+			}
+			if (c->fd < 0)
+				continue;
+			if (c->state == CS_queued) {
+				/* Gone before it had an opponent */
+				CloseConn(c);
+				continue;
+			}
+			if (c->state != CS_playing) {
+				ReadHello(c);
+				continue;
+			}
+			if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+				WriteConn(c);
+			if (c->fd >= 0 && c->peer
+					&& (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+				ReadConn(c);
+		}
+		while (hellos && time(0) - hellos->connectedAt >= HELLO_TIMEOUT)
+			CloseConn(hellos);
+		while ((c = freeList)) {
+			freeList = c->next;
+			free(c->out);
+			free(c);
+		}
+		if (statInterval && time(0) - lastStats >= statInterval) {
+			lastStats = time(0);
+			printf("%ld matches, %ld queued, %ld connections, "
+					"%ld started, %.0f bytes",
+					matches, queued, conns, totalMatches, bytesRelayed);
+			if (paired)
+				printf(", wait mean %.1fms max %.1fms",
+						totalWait / paired / 1000, maxWait / 1000.0);
+			printf("\n");
+			fflush(stdout);
+			paired = maxWait = 0;
+			totalWait = 0;
+		}
+	}
+}
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
@@ -26,9 +26,13 @@
 #include <string.h>
 #include <stdarg.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <errno.h>
 
+#define ROBOT_BUF_INIT	256			/* Must be a power of 2 */
+#define ROBOT_BUF_MAX	(1 << 20)	/* Longest line accepted from a robot */
+
 static MyEventType RobotGenFunc(EventGenRec *gen, MyEvent *event);
 
 static EventGenRec robotGen =
@@ -38,19 +42,31 @@ static int robotProcess;
 static FILE *toRobot = NULL;
 static int toRobotFd, fromRobotFd;
 
-static char robotBuf[128];
-static int robotBufSize, robotBufMsg;
+/*
+ * Input from the robot is kept in a ring buffer, which is doubled in
+ * size whenever it fills up without holding a complete line.  Lines
+ * which wrap around the end of the ring are copied into robotLine.
+ */
+static char *robotBuf, *robotLine;
+static int robotBufCap, robotLineCap;
+static int robotBufHead, robotBufSize;
+static int robotBufScan;	/* Bytes already searched for a newline */
+static int robotBufMore;	/* A complete line is waiting */
 
 static int gotSigPipe;
 
-ExtFunc void InitRobot(char *robotProg)
+static Shape *lastShape;
+static int lastY, lastX, lastCount;
+
+static FILE *recordFile = NULL;
+static char recordBuf[1024];
+static int recordBufSize;
+
+static void StartRobot(char *robotProg)
 {
 	int to[2], from[2];
 	int status;
-	MyEvent event;
 
-	signal(SIGPIPE, CatchPipe);
-	AtExit(CloseRobot);
 	if (pipe(to) || pipe(from))
 		die("pipe");
 	robotProcess = fork();
@@ -77,7 +93,24 @@ ExtFunc void InitRobot(char *robotProg)
 	status |= O_NONBLOCK;
 	if (fcntl(fromRobotFd, F_SETFL, status) < 0)
 		die("fcntl/F_SETFL");
+	if (!robotBuf) {
+		robotBufCap = ROBOT_BUF_INIT;
+		if (!(robotBuf = malloc(robotBufCap)))
+			die("malloc");
+	}
+	robotBufHead = robotBufSize = robotBufScan = robotBufMore = 0;
+	lastShape = NULL;
+	gotSigPipe = 0;
 	AddEventGen(&robotGen);
+}
+
+ExtFunc void InitRobot(char *robotProg)
+{
+	MyEvent event;
+
+	signal(SIGPIPE, CatchPipe);
+	AtExit(CloseRobot);
+	StartRobot(robotProg);
 	RobotCmd(1, "Version %d\n", ROBOT_VERSION);
 	if (WaitMyEvent(&event, EM_robot) != E_robot)
 		fatal("Robot didn't start successfully");
@@ -93,6 +126,44 @@ ExtFunc void CatchPipe(int sig)
 	robotGen.ready = gotSigPipe = 1;
 }
 
+/*
+ * Each complete line exchanged with the robot is recorded as
+ * "<seconds> <dir> <line>", where <dir> is '<' for lines sent to the
+ * robot and '>' for lines received from it.
+ */
+ExtFunc void RecordRobot(char *fileName)
+{
+	if (!(recordFile = fopen(fileName, "w")))
+		die(fileName);
+}
+
+static void RecordLine(char dir, char *line)
+{
+	fprintf(recordFile, "%.6f %c %s\n", CurTimeval() / 1.0e6, dir, line);
+}
+
+static void RecordText(char *text)
+{
+	char *p;
+
+	while ((p = strchr(text, '\n'))) {
+		*p = 0;
+		if (recordBufSize > 0) {
+			strncpy(recordBuf + recordBufSize, text,
+					sizeof(recordBuf) - recordBufSize - 1);
+			recordBuf[sizeof(recordBuf) - 1] = 0;
+			RecordLine('<', recordBuf);
+			recordBufSize = 0;
+		}
+		else
+			RecordLine('<', text);
+		text = p + 1;
+	}
+	while (*text && recordBufSize < sizeof(recordBuf) - 1)
+		recordBuf[recordBufSize++] = *text++;
+	recordBuf[recordBufSize] = 0;
+}
+
 ExtFunc void RobotCmd(int flush, char *fmt, ...)
 {
 	va_list args;
@@ -100,8 +171,38 @@ ExtFunc void RobotCmd(int flush, char *fmt, ...)
 	va_start(args, fmt);
 	vfprintf(toRobot, fmt, args);
 	va_end(args);
-	if (flush)
+	if (recordFile) {
+		va_start(args, fmt);
+		vsnprintf(scratch, sizeof(scratch), fmt, args);
+		va_end(args);
+		RecordText(scratch);
+	}
+	if (flush) {
 		fflush(toRobot);
+		if (recordFile)
+			fflush(recordFile);
+	}
+}
+
+/*
+ * Protocol version 2 tells the robot where the falling piece is, so it
+ * needn't reconstruct it from the RowUpdates.  Never sent to fair robots.
+ */
+ExtFunc void RobotPiece(int scr)
+{
+	Shape *shape = curShape[scr];
+
+	if (robotVersion < 2 || fairRobot || scr != 0 || !shape)
+		return;
+	if (shape == lastShape && curY[scr] == lastY && curX[scr] == lastX
+			&& pieceCount == lastCount)
+		return;
+	lastShape = shape;
+	lastY = curY[scr];
+	lastX = curX[scr];
+	lastCount = pieceCount;
+	RobotCmd(0, "Piece %d %d %d %d %d %d\n", scr, ShapeToNetNum(shape),
+			lastY, lastX, ShapeToRotation(shape), pieceCount);
 }
 
 ExtFunc void RobotTimeStamp(void)
@@ -109,11 +210,11 @@ ExtFunc void RobotTimeStamp(void)
 	RobotCmd(1, "TimeStamp %.3f\n", CurTimeval() / 1.0e6);
 }
 
-ExtFunc void CloseRobot(void)
+static void StopRobot(int sendExit)
 {
 	RemoveEventGen(&robotGen);
 	if(toRobot) {
-		if (robotProcess > 0)
+		if (sendExit && robotProcess > 0)
 			RobotCmd(1, "Exit\n");
 		fclose(toRobot);
 		close(fromRobotFd);
@@ -121,53 +222,240 @@ ExtFunc void CloseRobot(void)
 	}
 }
 
-static MyEventType RobotGenFunc(EventGenRec *gen, MyEvent *event)
+ExtFunc void CloseRobot(void)
 {
-	static int more;
-	int result, i;
+	StopRobot(1);
+}
+
+/*
+ * Read a line of any length, without its newline
+ */
+static char *ReadRecordLine(FILE *file, char **buf, int *cap)
+{
+	int len = 0;
+
+	if (!*buf) {
+		*cap = ROBOT_BUF_INIT;
+		if (!(*buf = malloc(*cap)))
+			die("malloc");
+	}
+	while (fgets(*buf + len, *cap - len, file)) {
+		len += strlen(*buf + len);
+		if ((*buf)[len-1] == '\n') {
+			(*buf)[len-1] = 0;
+			return *buf;
+		}
+		if (len == *cap - 1) {
+			*cap *= 2;
+			if (!(*buf = realloc(*buf, *cap)))
+				die("realloc");
+		}
+	}
+	return len > 0 ? *buf : NULL;
+}
+
+/*
+ * Feed the lines recorded with -l to a fresh robot, as fast as it will
+ * take them, and check that it answers with the same lines.  Reply
+ * latency is measured from the last line sent to the robot, both in the
+ * recording and in the replay, so robot builds can be compared directly.
+ */
+ExtFunc int ReplayRobot(char *robotProg, char *fileName)
+{
+	FILE *file;
+	char *line = NULL, *text;
+	MyEvent event;
+	MyEventType type;
+	double when, lastInput = 0, latency;
+	double recTotal = 0, recMax = 0, repTotal = 0, repMax = 0;
+	long sentAt = 0;
+	int lineNum = 0, running = 0, lineCap, n;
+	int inputs = 0, replies = 0, matched = 0, missing = 0;
+	char dir;
+
+	if (!(file = fopen(fileName, "r")))
+		die(fileName);
+	signal(SIGPIPE, CatchPipe);
+	while (ReadRecordLine(file, &line, &lineCap)) {
+		++lineNum;
+		if (sscanf(line, "%lf %c %n", &when, &dir, &n) < 2)
+			continue;
+		text = line + n;
+		if (!running) {
+			StartRobot(robotProg);
+			running = 1;
+		}
+		if (dir == '<') {
+			fprintf(toRobot, "%s\n", text);
+			fflush(toRobot);
+			sentAt = CurTimeval();
+			lastInput = when;
+			inputs++;
+			if (!strcmp(text, "Exit")) {
+				StopRobot(0);
+				running = 0;
+			}
+			continue;
+		}
+		if (dir != '>')
+			continue;
+		replies++;
+		latency = when - lastInput;
+		recTotal += latency;
+		if (recMax < latency)
+			recMax = latency;
+		SetITimer(0, REPLAY_TIMEOUT);
+		type = WaitMyEvent(&event, EM_robot | EM_alarm);
+		SetITimer(0, 0);
+		if (type != E_robot) {
+			fprintf(stderr, "%s:%d: no reply, expected \"%s\"\n",
+					fileName, lineNum, text);
+			missing++;
+			if (type == E_lostRobot) {
+				StopRobot(0);
+				running = 0;
+			}
+			continue;
+		}
+		latency = (CurTimeval() - sentAt) / 1.0e6;
+		repTotal += latency;
+		if (repMax < latency)
+			repMax = latency;
+		if (!strcmp(event.u.robot.data, text))
+			matched++;
+		else
+			fprintf(stderr, "%s:%d: expected \"%s\", got \"%s\"\n",
+					fileName, lineNum, text, event.u.robot.data);
+	}
+	fclose(file);
+	free(line);
+	if (running)
+		StopRobot(1);
+	printf("Replayed %d lines to the robot, %d of %d replies matched "
+			"(%d missing)\n", inputs, matched, replies, missing);
+	if (replies > 0)
+		printf("Reply latency (ms): recorded mean %.3f max %.3f, "
+				"replay mean %.3f max %.3f\n",
+				recTotal * 1e3 / replies, recMax * 1e3,
+				repTotal * 1e3 / replies, repMax * 1e3);
+	return matched == replies ? 0 : 1;
+}
+
+/*
+ * Returns whether there's a complete line in the buffer, leaving
+ * robotBufScan at its newline
+ */
+static int FindRobotLine(void)
+{
+	int start, len;
 	char *p;
 
+	while (robotBufScan < robotBufSize) {
+		start = (robotBufHead + robotBufScan) & (robotBufCap - 1);
+		len = robotBufSize - robotBufScan;
+		if (len > robotBufCap - start)
+			len = robotBufCap - start;
+		if ((p = memchr(robotBuf + start, '\n', len))) {
+			robotBufScan += p - (robotBuf + start);
+			return 1;
+		}
+		robotBufScan += len;
+	}
+	return 0;
+}
+
+static void GrowRobotBuf(void)
+{
+	char *buf;
+	int first;
+
+	if (robotBufCap >= ROBOT_BUF_MAX)
+		fatal("Line from robot is too long");
+	if (!(buf = malloc(2 * robotBufCap)))
+		die("malloc");
+	first = robotBufCap - robotBufHead;
+	if (first > robotBufSize)
+		first = robotBufSize;
+	memcpy(buf, robotBuf + robotBufHead, first);
+	memcpy(buf + first, robotBuf, robotBufSize - first);
+	free(robotBuf);
+	robotBuf = buf;
+	robotBufCap *= 2;
+	robotBufHead = 0;
+}
+
+static int ReadRobot(void)
+{
+	struct iovec iov[2];
+	int tail, count, result;
+
+	if (robotBufSize == robotBufCap)
+		GrowRobotBuf();
+	if (robotBufSize == 0)
+		robotBufHead = 0;
+	tail = (robotBufHead + robotBufSize) & (robotBufCap - 1);
+	iov[0].iov_base = robotBuf + tail;
+	count = 1;
+	if (tail < robotBufHead)
+		iov[0].iov_len = robotBufHead - tail;
+	else {
+		iov[0].iov_len = robotBufCap - tail;
+		iov[1].iov_base = robotBuf;
+		iov[1].iov_len = robotBufHead;
+		count += robotBufHead > 0;
+	}
+	do {
+		result = readv(fromRobotFd, iov, count);
+	} while (result < 0 && errno == EINTR);
+	if (result > 0)
+		robotBufSize += result;
+	return result;
+}
+
+static MyEventType RobotGenFunc(EventGenRec *gen, MyEvent *event)
+{
+	int len, first;
+	char *line;
+
 	if (gotSigPipe) {
 		gotSigPipe = 0;
-		robotGen.ready = more;
+		robotGen.ready = robotBufMore;
 		return E_lostRobot;
 	}
-	if (robotBufMsg > 0) {
-		/*
-		 *	Grrrrrr!  SunOS 4.1 doesn't have memmove (or atexit)
-		 *  I'm told some others have a broken memmove
-		 *
-		 *	memmove(robotBuf, robotBuf + robotBufMsg,
-		 *			robotBufSize - robotBufMsg);
-		 */
-		for (i = robotBufMsg; i < robotBufSize; ++i)
-			robotBuf[i - robotBufMsg] = robotBuf[i];
-
-		robotBufSize -= robotBufMsg;
-		robotBufMsg = 0;
-	}
-	if (more)
-		more = 0;
+	if (robotBufMore)
+		robotBufMore = 0;
 	else {
-		do {
-			result = read(fromRobotFd, robotBuf + robotBufSize,
-					sizeof(robotBuf) - robotBufSize);
-		} while (result < 0 && errno == EINTR);
-		if (result <= 0)
+		if (ReadRobot() <= 0)
 			return E_lostRobot;
-		robotBufSize += result;
+		if (!FindRobotLine())
+			return E_none;
 	}
-	if (!(p = memchr(robotBuf, '\n', robotBufSize))) {
-		if (robotBufSize >= sizeof(robotBuf))
-			fatal("Line from robot is too long");
-		return E_none;
+	len = robotBufScan;
+	if (robotBufHead + len < robotBufCap) {
+		line = robotBuf + robotBufHead;
+		line[len] = 0;
+	}
+	else {
+		if (robotLineCap < len + 1) {
+			free(robotLine);
+			robotLineCap = robotBufCap;
+			if (!(robotLine = malloc(robotLineCap)))
+				die("malloc");
+		}
+		first = robotBufCap - robotBufHead;
+		memcpy(robotLine, robotBuf + robotBufHead, first);
+		memcpy(robotLine + first, robotBuf, len - first);
+		line = robotLine;
+		line[len] = 0;
 	}
-	*p = 0;
-	robotBufMsg = p - robotBuf + 1;
-	robotGen.ready = more = (memchr(robotBuf + robotBufMsg, '\n',
-			robotBufSize - robotBufMsg) != NULL);
-	event->u.robot.size = p - robotBuf;
-	event->u.robot.data = robotBuf;
+	robotBufHead = (robotBufHead + len + 1) & (robotBufCap - 1);
+	robotBufSize -= len + 1;
+	robotBufScan = 0;
+	robotGen.ready = robotBufMore = FindRobotLine();
+	event->u.robot.size = len;
+	event->u.robot.data = line;
+	if (recordFile)
+		RecordLine('>', line);
 	return E_robot;
 }
 
@@ -179,6 +179,34 @@ ExtFunc short ShapeToNetNum(Shape *shape)
 	return 0;
 }
 
+/*
+ * Number of rotations needed to turn the shape chosen from stdOptions
+ * into this one
+ */
+ExtFunc int ShapeToRotation(Shape *shape)
+{
+	int i, rot;
+	Shape *s;
+
+	for (i = 0; stdOptions[i].shape; ++i)
+		for (s = stdOptions[i].shape, rot = 0; rot < 4;
+				s = s->rotateTo, ++rot)
+			if (s == shape)
+				return rot;
+	assert(0);
+	return 0;
+}
+
+ExtFunc int ShapeRotations(Shape *shape)
+{
+	int count = 1;
+	Shape *s;
+
+	for (s = shape->rotateTo; s != shape; s = s->rotateTo)
+		++count;
+	return count;
+}
+
 ExtFunc Shape *NetNumToShape(short num)
 {
 	assert(num >= 0 && num < sizeof(netMapping) / sizeof(netMapping[0]) - 1);
@@ -23,49 +23,84 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-#include <math.h>
-#include <limits.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "sr.h"
 
-/* Both of these should be at least twice the actual max */
-#define MAX_BOARD_WIDTH		32
-#define MAX_BOARD_HEIGHT	64
+#define ROBOT_VERSION		2
+
+/* Protocol version 2 opcodes */
+#define RC_place	16
 
 char b[1024];
 FILE *logFile;
 
-int twoPlayer;
-int boardHeight, boardWidth;
-int board[MAX_BOARD_HEIGHT][MAX_BOARD_WIDTH];
-int piece[4][4];
-int pieceLast[4][4];
+#define Logging()	(logFile || binaryLog)
 
-int board1[MAX_BOARD_HEIGHT][MAX_BOARD_WIDTH];
-int piece1[4][4];
-int piece2[4][4];
+int twoPlayer;
+int robotVersion = 1;
+int board[MAX_BOARD_HEIGHT][MAX_BOARD_WIDTH];	/* As sent by Netris */
+Row rows[MAX_BOARD_HEIGHT];		/* Blocks which aren't falling */
+Row oppRows[MAX_BOARD_HEIGHT];	/* The same on the opponent's board */
+int oppKnown;			/* The opponent's board is the same size */
 
 int pieceCount;		/* Serial number of current piece, for sending commands */
 int pieceVisible;	/* How many blocks of the current piece are visible */
+int pieceShape;		/* Shape of the current piece, -1 if unknown */
 int pieceBottom, pieceLeft;	/* Position of bottom-left square */
-int pieceBottomLast, pieceLeftLast;
+int pieceShapeLast = -1, pieceLeftLast, pieceBottomLast;	/* At last key */
+Move moveLast;
+
+/* From the last "Piece" line, if the protocol version has them */
+int netShape = -1, pieceY, pieceX, pieceRot;
 
 /*
  * 0 = Not decided yet
  * 1 = decided
- * 2 = move in progress
- * 3 = drop in progress
+ * 2 = key sent, waiting for it to move the piece
+ * 3 = at the goal, or placement or drop in progress
  */
 int pieceState;
 
-int leftDest;
-int pieceDest[4][4];
+int leftDest, shapeDest, rowDest;
+MoveGen moveGen;
+
+#define DECISION_SHARE	0.5		/* Share of the fall spent deciding */
+#define MOVE_TICKS		2		/* Ticks to wait for a move to happen */
+
+int iterDepth;			/* Depth of the current iteration */
+float tickLength = 0.3;
 
 int masterEnable = 1, dropEnable = 1;
 
 float curTime, moveTimeout;
+float pieceTime = -1;	/* When the current piece was first seen */
+
+/*
+ * Log a line read (type ' '), written ('>') or noted ('#'), with or
+ * without its newline
+ */
+void LogLine(int type, char *line)
+{
+	int len = strlen(line);
 
-int min(int a, int b)
+	if (len > 0 && line[len-1] == '\n')
+		--len;
+	if (logFile)
+		fprintf(logFile, "%c %.*s\n", type, len, line);
+	if (binaryLog)
+		AppendLog(type, line, len);
+}
+
+void Note(char *fmt, ...)
 {
-	return a < b ? a : b;
+	char line[1024];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	LogLine('#', line);
 }
 
 char *ReadLine(char *buf, int size)
@@ -77,21 +112,24 @@ char *ReadLine(char *buf, int size)
 	len = strlen(buf);
 	if (len > 0 && buf[len-1] == '\n')
 		buf[len-1] = 0;
-	if (logFile)
-		fprintf(logFile, "  %s\n", buf);
+	if (Logging())
+		LogLine(' ', buf);
 	return buf;
 }
 
 int WriteLine(char *fmt, ...)
 {
+	char line[1024];
 	int result;
-	va_list args;
+	va_list args, copy;
 
 	va_start(args, fmt);
-	result = vfprintf(stdout, fmt, args);
-	if (logFile) {
-		fprintf(logFile, "> ");
-		vfprintf(logFile, fmt, args);
+	va_copy(copy, args);
+	result = vfprintf(stdout, fmt, copy);
+	va_end(copy);
+	if (Logging()) {
+		vsnprintf(line, sizeof(line), fmt, args);
+		LogLine('>', line);
 	}
 	va_end(args);
 	return result;
@@ -100,8 +138,10 @@ int WriteLine(char *fmt, ...)
 void FindPiece(void)
 {
 	int row, col;
+	int pic[4][4];
 
 	pieceVisible = 0;
+	pieceShape = -1;
 	pieceBottom = MAX_BOARD_HEIGHT;
 	pieceLeft = MAX_BOARD_WIDTH;
 	for (row = boardHeight - 1; row >= 0; --row)
@@ -112,192 +152,57 @@ void FindPiece(void)
 					pieceLeft = col;
 				pieceVisible++;
 			}
+	if (!pieceVisible)
+		return;
 	for (row = 0; row < 4; ++row)
 		for (col = 0; col < 4; ++col)
-			piece[row][col] = board[pieceBottom + row][pieceLeft + col] < 0;
-}
-
-void RotatePiece1(void)
-{
-	int row, col, height = 0;
-
-	for (row = 0; row < 4; ++row)
-		for (col = 0; col < 4; ++col)
-		{
-			piece2[row][col] = piece1[row][col];
-			piece1[row][col] = 0;
-			if (piece2[row][col])
-				height = row + 1;
-		}
-	for (row = 0; row < 4; ++row)
-		for (col = 0; col < height; ++col)
-			piece1[row][col] = piece2[height - col - 1][row];
+			pic[row][col] = pieceBottom + row < MAX_BOARD_HEIGHT
+				&& pieceLeft + col < MAX_BOARD_WIDTH
+				&& board[pieceBottom + row][pieceLeft + col] < 0;
+	pieceShape = PictureShape(pic);
 }
 
-int PieceFits(int row, int col)
+/*
+ * Like FindPiece, but using the last "Piece" line instead of
+ * scanning the board
+ */
+void ShapePiece(void)
 {
-	int i, j;
+	int i;
 
-	if (row < 0)
-		return 0;
+	pieceShape = netShape;
+	pieceBottom = pieceY + orients[netShape].bottom;
+	pieceLeft = pieceX + orients[netShape].left;
+	pieceVisible = 0;
 	for (i = 0; i < 4; ++i)
-		for (j = 0; j < 4; ++j)
-			if (piece1[i][j])
-				if (col+j >= boardWidth || board[row+i][col+j] > 0)
-					return 0;
-	return 1;
+		if (pieceY + shapes[netShape].cell[i][0] < boardHeight)
+			pieceVisible++;
 }
 
-int SimPlacement(int row, int col)
+/*
+ * Send a single command placing the piece where MakeDecision wants it.
+ * Returns 0 if the destination isn't one of the piece's rotations.
+ */
+int SendPlacement(void)
 {
-	int i, j;
-	int from, to, count;
-
-	for (i = 0; i < boardHeight; ++i)
-		for (j = 0; j < boardWidth; ++j) {
-			board1[i][j] = board[i][j] > 0;
-			if (i >= row && i < row+4 && j >= col && j < col+4)
-				if (piece1[i - row][j - col])
-					board1[i][j] = 1;
+	int shape, rot;
+
+	for (shape = netShape, rot = 0; rot < 4;
+			shape = shapes[shape].rotateTo, ++rot)
+		if (shape == shapeDest) {
+			WriteLine("%d %d %d %d\n", RC_place, pieceCount,
+					pieceRot + rot, leftDest - orients[shape].left);
+			return 1;
 		}
-	for (from = to = 0; to < boardHeight; ++from) {
-		count = boardWidth;
-		for (j = 0; j < boardWidth; ++j)
-			count -= board1[to][j] = board1[from][j];
-		to += (count > 0);
-	}
-	return from - to;
+	return 0;
 }
 
-double BoardScore(int linesCleared, int pRow, int verbose)
+/*
+ * How long to wait for a move to show up before trying again
+ */
+float MoveTimeout(void)
 {
-	double score = 0;
-	double avgHeight2 = 0, avgHolesTimesDepth = 0;
-	int maxMidHeight = 0, maxHeight = 0;
-	int height[MAX_BOARD_WIDTH];
-	int holesTimesDepth[MAX_BOARD_WIDTH];
-	int holes[MAX_BOARD_WIDTH];
-	double hardFit[MAX_BOARD_HEIGHT];
-	int depend[MAX_BOARD_HEIGHT];
-	int cover[MAX_BOARD_WIDTH];
-	int row, col, count, i;
-	int deltaLeft, deltaRight;
-	double closeToTop, topShape = 0, fitProbs = 0, space = 0;
-	double maxHard;
-
-	for (col = 0; col < boardWidth; ++col) {
-		cover[col] = 0;
-		height[col] = 0;
-		for (row = 0; row < boardHeight; ++row)
-			if (board1[row][col])
-				height[col] = row + 1;
-		avgHeight2 += height[col] * height[col];
-		if (maxHeight < height[col])
-			maxHeight = height[col];
-		if (col >= 2 && col < boardWidth - 2 && maxMidHeight < height[col])
-			maxMidHeight = height[col];
-		holes[col] = 0;
-		holesTimesDepth[col] = 0;
-		for (row = 0; row < height[col]; ++row) {
-			if (board1[row][col])
-				holesTimesDepth[col] += holes[col];
-			else
-				holes[col]++;
-		}
-		avgHolesTimesDepth += holesTimesDepth[col];
-	}
-	avgHeight2 /= boardWidth;
-	avgHolesTimesDepth /= boardWidth;
-
-	/* Calculate dependencies */
-	for (row = maxHeight - 1; row >= 0; --row) {
-		depend[row] = 0;
-		for (col = 0; col < boardWidth; ++col) {
-			if (board1[row][col])
-				cover[col] |= 1 << row;
-			else
-				depend[row] |= cover[col];
-		}
-		for (i = row + 1; i < maxHeight; ++i)
-			if (depend[row] & (1 << i))
-				depend[row] |= depend[i];
-	}
-
-	/* Calculate hardness of fit */
-	for (row = maxHeight - 1; row >= 0; --row) {
-		hardFit[row] = 5;
-		count = 0;
-		for (col = 0; col < boardWidth; ++col) {
-			if (board1[row][col]) {
-				space += 0.5;
-			}
-			else if (!board1[row][col]) {
-				count++;
-				space += 1;
-				hardFit[row]++;
-				if (height[col] < row)
-					hardFit[row] += row - height[col];
-				if (col > 0)
-					deltaLeft = height[col - 1] - row;
-				else
-					deltaLeft = MAX_BOARD_HEIGHT;
-				if (col < boardWidth - 1)
-					deltaRight = height[col + 1] - row;
-				else
-					deltaRight = MAX_BOARD_HEIGHT;
-				if (deltaLeft > 2 && deltaRight > 2)
-					hardFit[row] += 7;
-				else if (deltaLeft > 2 || deltaRight > 2)
-					hardFit[row] += 2;
-				else if (abs(deltaLeft) == 2 && abs(deltaRight) == 2)
-					hardFit[row] += 2;
-				else if (abs(deltaLeft) == 2 || abs(deltaRight) == 2)
-					hardFit[row] += 3;
-			}
-		}
-		maxHard = 0;
-		for (i = row + 1; i < row + 5 && i < maxHeight; ++i)
-			if (depend[row] & (1 << i))
-				if (maxHard < hardFit[i])
-					maxHard = hardFit[i];
-		fitProbs += maxHard * count;
-	}
-
-	/* Calculate score based on top shape */
-	for (col = 0; col < boardWidth; ++col) {
-		if (col > 0)
-			deltaLeft = height[col - 1] - height[col];
-		else
-			deltaLeft = MAX_BOARD_HEIGHT;
-		if (col < boardWidth - 1)
-			deltaRight = height[col + 1] - height[col];
-		else
-			deltaRight = MAX_BOARD_HEIGHT;
-		if (deltaLeft > 2 && deltaRight > 2)
-			topShape += 15 + 15 * (min(deltaLeft, deltaRight) / 4);
-		else if (deltaLeft > 2 || deltaRight > 2)
-			topShape += 2;
-		else if (abs(deltaLeft) == 2 && abs(deltaRight) == 2)
-			topShape += 2;
-		else if (abs(deltaLeft) == 2 || abs(deltaRight) == 2)
-			topShape += 3;
-	}
-
-	closeToTop = (pRow / (double)boardHeight);
-	closeToTop *= closeToTop;
-
-	closeToTop *= 200;
-	space /= 2;
-	score = space + closeToTop + topShape + fitProbs - linesCleared * 10;
-
-	if (verbose) {
-		WriteLine("Message space=%g, close=%g, shape=%g\n",
-			space, closeToTop, topShape);
-		WriteLine("Message fitProbs=%g, cleared=%d\n",
-			fitProbs, -linesCleared * 10);
-	}
-
-	return score;
+	return tickLength * MOVE_TICKS < 0.5 ? tickLength * MOVE_TICKS : 0.5;
 }
 
 void PrintGoal(void)
@@ -309,68 +214,365 @@ void PrintGoal(void)
 	for (i = 0; i < 4; ++i) {
 		b[c++] = ':';
 		for (j = 0; j < 4; ++j)
-			b[c++] = pieceDest[i][j] ? '*' : ' ';
+			b[c++] = (orients[shapeDest].rows[i] >> j) & 1 ? '*' : ' ';
 	}
 	b[c++]=':';
 	b[c++]=0;
 	WriteLine("Message Goal %d %s\n", leftDest, b);
 }
 
-double MakeDecision(void)
+/*
+ * Candidate placements for the current piece, scored in chunks of
+ * LANES by whichever thread gets to them.  The best is picked in
+ * candidate order afterwards, so the choice doesn't depend on the
+ * number of threads.
+ */
+Placement cands[MAX_PLACEMENTS];
+int numCands;
+int beam[BATCH_MAX];
+double beamValue[BATCH_MAX];
+
+/* Junk lines Netris sends the opponent for clearing lines */
+#define JunkSent(lines)	((lines) > 1 ? (lines) - ((lines) < 4) : 0)
+
+int adversary;			/* Look ahead against the opponent, with -a */
+int versus;				/* And there's an opponent */
+double oppWeight;		/* Share of the opponent's score in the robot's */
+
+/*
+ * Look ahead from brd as the opponent replies to it.  The junk from
+ * the lines cleared goes to the opponent, which drops its next piece
+ * where it scores best, and any junk that sends comes back before the
+ * robot's next piece.  The opponent gets whichever piece is worst for
+ * the robot.  Netris puts the hole in the junk anywhere; here it's in
+ * the middle.
+ */
+double AgainstOpponent(Search *search, Row *brd, int lines, int depth)
 {
-	int row, col, rot;
-	int linesCleared;
-	int first = 1;
-	double minScore = 0, score;
-
-	memcpy(piece1, piece, sizeof(piece));
-	for (rot = 0; rot < 4; ++rot) {
-		RotatePiece1();
-		for (col = 0; col < boardWidth; ++col) {
-			if (!PieceFits(pieceBottom, col))
-				continue;
-			for (row = pieceBottom; PieceFits(row-1, col); --row)
-				;
-			linesCleared = SimPlacement(row, col);
-			score = BoardScore(linesCleared, row, 0);
-			if (first || minScore > score) {
-				first = 0;
-				minScore = score;
-				memcpy(pieceDest, piece1, sizeof(piece));
-				leftDest = col;
-			}
+	Row theirs[MAX_BOARD_HEIGHT], next[MAX_BOARD_HEIGHT];
+	Row mine[MAX_BOARD_HEIGHT];
+	Placement list[BATCH_MAX];
+	int shape, n, i, best, sent;
+	double value, worst = -LOST_SCORE;
+
+	memcpy(theirs, oppRows, sizeof(theirs));
+	if (AddJunk(theirs, JunkSent(lines), boardWidth / 2))
+		return -LOST_SCORE;
+	for (i = 0; nextOptions[i].weight; ++i) {
+		shape = nextOptions[i].shape;
+		n = ListPlacements(theirs, shape,
+				boardHeight - orients[shape].height, list);
+		if (n == 0)
+			continue;			/* The opponent loses */
+		ScorePlacements(search, theirs, list, n);
+		BestPlacements(list, n, &best, 1);
+		sent = SimPlacement(theirs, next, list[best].shape, list[best].row,
+				list[best].col);
+		memcpy(mine, brd, sizeof(mine));
+		if (AddJunk(mine, JunkSent(sent), boardWidth / 2))
+			return LOST_SCORE;
+		value = Lookahead(search, mine, depth)
+			- oppWeight * PlacedLeafScore(search, theirs, &list[best], next);
+		if (worst < value)
+			worst = value;
+	}
+	return worst;
+}
+
+void ScoreCands(Search *search, int chunk)
+{
+	int first = chunk * LANES;
+
+	ScorePlacements(search, rows, &cands[first],
+			min(LANES, numCands - first));
+}
+
+void ExpandBeam(Search *search, int item)
+{
+	Row child[MAX_BOARD_HEIGHT];
+	Placement *cand = &cands[beam[item]];
+	int lines;
+
+	lines = SimPlacement(rows, child, cand->shape, cand->row, cand->col);
+	if (versus)
+		beamValue[item] = AgainstOpponent(search, child, lines, iterDepth - 1);
+	else
+		beamValue[item] = Lookahead(search, child, iterDepth - 1);
+	beamValue[item] -= lines * weights.lineCleared;
+}
+
+/*
+ * Rollouts of the beam, ROLLOUT_ROUND for each placement at a time.
+ * Rollout r of every placement uses the same stream of pieces, so the
+ * placements are compared on the same pieces.
+ */
+#define ROLLOUT_ROUND	8
+
+int rollouts;			/* For each placement in the beam, with -M */
+int rolloutPieces = 10;	/* Longest rollout, with -P */
+int rolloutsDone, rolloutBeam;	/* Before this round, and its placements */
+double rolloutTotal[BATCH_MAX], rolloutValue[BATCH_MAX * ROLLOUT_ROUND];
+int rolloutPlayed[BATCH_MAX * ROLLOUT_ROUND];
+
+void RollOut(Search *search, int item)
+{
+	Row child[MAX_BOARD_HEIGHT];
+	Placement *cand = &cands[beam[item % rolloutBeam]];
+	int lines, seed;
+
+	seed = (unsigned)(pieceCount * 1024 + rolloutsDone + item / rolloutBeam)
+		* 7919 % 31751 + 1;
+	lines = SimPlacement(rows, child, cand->shape, cand->row, cand->col);
+	rolloutValue[item] = Rollout(child, seed, rolloutPieces,
+			&rolloutPlayed[item]) - lines * weights.lineCleared;
+}
+
+/*
+ * Score the beam by the average of its rollouts, doing rounds of them
+ * until there are enough or the deadline passes, and return the best
+ */
+int RollBeam(int count)
+{
+	struct timeval start, now;
+	int n, i, best, played = 0;
+
+	gettimeofday(&start, NULL);
+	rolloutBeam = count;
+	for (n = 0; n < count; ++n)
+		rolloutTotal[n] = 0;
+	for (rolloutsDone = 0; rolloutsDone < rollouts;
+			rolloutsDone += ROLLOUT_ROUND) {
+		if (OutOfTime())
+			break;
+		RunJob(RollOut, count * ROLLOUT_ROUND);
+		for (i = 0; i < count * ROLLOUT_ROUND; ++i) {
+			rolloutTotal[i % count] += rolloutValue[i];
+			played += rolloutPlayed[i];
 		}
 	}
+	if (Logging()) {
+		gettimeofday(&now, NULL);
+		Note("%d rollouts, %d pieces in %.3fs",
+				rolloutsDone, played, now.tv_sec - start.tv_sec
+				+ (now.tv_usec - start.tv_usec) / 1e6);
+	}
+	for (best = 0, n = 1; n < count; ++n)
+		if (rolloutTotal[best] > rolloutTotal[n])
+			best = n;
+	return best;
+}
+
+/*
+ * Allow the search part of the time the piece will take to fall to
+ * the top of the stack, less what has passed since it appeared
+ */
+void SetDeadline(void)
+{
+	struct timeval now;
+	int height[MAX_BOARD_WIDTH], fall;
+	double budget;
+
+	fall = pieceBottom - ColumnHeights(rows, height);
+	if (fall < 1)
+		fall = 1;
+	budget = fall * tickLength * DECISION_SHARE;
+	if (pieceTime >= 0)
+		budget -= curTime - pieceTime;
+	if (budget < 0)
+		budget = 0;
+	gettimeofday(&now, NULL);
+	deadline.tv_sec = now.tv_sec + (int)budget;
+	deadline.tv_usec = now.tv_usec + (budget - (int)budget) * 1e6;
+	if (deadline.tv_usec >= 1000000) {
+		deadline.tv_sec++;
+		deadline.tv_usec -= 1000000;
+	}
+	outOfTime = 0;
+}
+
+/*
+ * Choose where to put the current piece.  The greedy choice is always
+ * made, then the beam is searched one piece deeper at a time until
+ * searchDepth or the deadline, keeping the choice of the deepest
+ * search which finished.  With -M the beam is scored by rollouts
+ * instead.
+ */
+double MakeDecision(void)
+{
+	int n, count, best;
+
+	SetDeadline();
+	tableAge = (tableAge + 1) & 0xff;
+
+	numCands = ReachablePlacements(&moveGen, rows, pieceShape, pieceBottom,
+			pieceLeft, cands, MAX_PLACEMENTS);
+	if (numCands == 0) {
+		PrintGoal();
+		return 0;
+	}
+	RunJob(ScoreCands, (numCands + LANES - 1) / LANES);
+	count = BestPlacements(cands, numCands, beam,
+			searchDepth > 1 || rollouts ? beamWidth : 1);
+	versus = adversary && twoPlayer && oppKnown;
+	best = rollouts ? RollBeam(count) : 0;
+	for (iterDepth = 2; !rollouts && iterDepth <= searchDepth; ++iterDepth) {
+		if (OutOfTime())
+			break;
+		RunJob(ExpandBeam, count);
+		if (outOfTime)
+			break;
+		for (best = 0, n = 1; n < count; ++n)
+			if (beamValue[best] > beamValue[n])
+				best = n;
+	}
+	if (Logging() && !rollouts)
+		Note("searched %d pieces deep", iterDepth - 1);
+	shapeDest = cands[beam[best]].shape;
+	leftDest = cands[beam[best]].col;
+	rowDest = cands[beam[best]].row;
 	PrintGoal();
-	return minScore;
+	return cands[beam[best]].score;
+}
+
+/*
+ * The first key on the shortest way from where the piece is to the
+ * goal, MV_none if it's there, or -1 if it can't get there any more
+ */
+int NextMove(void)
+{
+	Move path[MAX_PATH];
+	int n;
+
+	ReachablePlacements(&moveGen, rows, pieceShape, pieceBottom, pieceLeft,
+			NULL, 0);
+	n = MovePath(&moveGen, shapeDest, rowDest, leftDest, path);
+	if (n < 0)
+		return -1;
+	return n ? path[0] : MV_none;
+}
+
+/*
+ * Whether RC_place would get the piece to the goal: it turns the piece
+ * where it is, then moves it across, then drops it
+ */
+int Straight(void)
+{
+	int shape = pieceShape, row = pieceBottom, col = pieceLeft, next;
+
+	while (shape != shapeDest) {
+		next = shapes[shape].rotateTo;
+		row += orients[next].bottom - orients[shape].bottom;
+		col += orients[next].left - orients[shape].left;
+		shape = next;
+		if (shape == pieceShape || col < 0 || !PieceFits(rows, shape, row, col))
+			return 0;
+	}
+	while (col != leftDest) {
+		col += col < leftDest ? 1 : -1;
+		if (!PieceFits(rows, shape, row, col))
+			return 0;
+	}
+	while (PieceFits(rows, shape, row - 1, col))
+		--row;
+	return row == rowDest;
 }
 
 double PeekScore(int verbose)
 {
 	int row, col, linesCleared;
 
-	memcpy(piece1, piece, sizeof(piece));
 	col = pieceLeft;
-	for (row = pieceBottom; PieceFits(row-1, col); --row)
+	for (row = pieceBottom; PieceFits(rows, pieceShape, row-1, col); --row)
 		;
-	linesCleared = SimPlacement(row, col);
-	return BoardScore(linesCleared, row, verbose);
+	linesCleared = SimPlacement(rows, searches[0].board,
+			pieceShape, row, col);
+	return BoardScore(searches[0].board, linesCleared, row, verbose);
 }
 
 int main(int argc, char **argv)
 {
-	int ac;
+	int ac, ch;
 	char *av[32];
-
-	if (argc == 2 && !strcmp(argv[1], "-l")) {
-		logFile = fopen("log", "w");
-		if (!logFile) {
-			perror("fopen log");
-			exit(1);
+	char *evaluator = NULL;
+	int threads = 1, tableSize = 16;
+	char *policy = NULL, *profileName = NULL;
+
+	while ((ch = getopt(argc, argv, "lL:e:t:d:w:m:R:W:N:a:M:P:T:")) != -1)
+		switch (ch) {
+			case 'l':
+				logFile = fopen("log", "w");
+				if (!logFile) {
+					perror("fopen log");
+					exit(1);
+				}
+				break;
+			case 'L':
+				OpenLog(optarg);
+				break;
+			case 'e':
+				evaluator = optarg;
+				break;
+			case 't':
+				threads = atoi(optarg);
+				if (threads < 1)
+					threads = 1;
+				break;
+			case 'd':
+				searchDepth = atoi(optarg);
+				if (searchDepth < 1)
+					searchDepth = 1;
+				break;
+			case 'w':
+				beamWidth = atoi(optarg);
+				if (beamWidth < 1)
+					beamWidth = 1;
+				if (beamWidth > BATCH_MAX)
+					beamWidth = BATCH_MAX;
+				break;
+			case 'm':
+				tableSize = atoi(optarg);
+				break;
+			case 'R':
+				policy = optarg;
+				break;
+			case 'W':
+				ReadWeights(optarg, &weights);
+				break;
+			case 'N':
+				LoadNet(optarg);
+				break;
+			case 'a':
+				adversary = 1;
+				oppWeight = atof(optarg);
+				break;
+			case 'M':
+				rollouts = atoi(optarg);
+				break;
+			case 'P':
+				rolloutPieces = atoi(optarg);
+				if (rolloutPieces < 1)
+					rolloutPieces = 1;
+				break;
+			case 'T':
+				profileName = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: sr [-l] [-L log] [-e scalar|sse2|avx2] "
+						"[-t threads] [-d depth] [-w width]\n"
+						"          [-m table-megabytes] [-R depth|always] "
+						"[-W weights]\n"
+						"          [-N network] [-a opponent-weight] "
+						"[-M rollouts] [-P pieces]\n"
+						"          [-T profile]\n");
+				exit(1);
 		}
-	}
+	InitOrients();
+	InitProfile(profileName);
+	InitKernel(evaluator);
+	InitThreads(threads);
+	InitTable(tableSize, policy);
 	setvbuf(stdout, NULL, _IOLBF, 0);
-	WriteLine("Version 1\n");
+	WriteLine("Version %d\n", ROBOT_VERSION);
 	while(ReadLine(b, sizeof b)) {
 		av[0] = strtok(b, " ");
 		if (!av[0])
@@ -380,25 +582,63 @@ int main(int argc, char **argv)
 			ac++;
 		if (!strcmp(av[0], "Exit"))
 			return 0;
+		else if (!strcmp(av[0], "Version") && ac >= 2)
+			robotVersion = min(atoi(av[1]), ROBOT_VERSION);
+		else if (!strcmp(av[0], "Piece") && ac >= 7) {
+			if (atoi(av[1]) != 0 || atoi(av[2]) < 0 || atoi(av[2]) >= NUM_SHAPES)
+				continue;
+			netShape = atoi(av[2]);
+			pieceY = atoi(av[3]);
+			pieceX = atoi(av[4]);
+			pieceRot = atoi(av[5]);
+		}
 		else if (!strcmp(av[0], "NewPiece") && ac >= 2) {
 			pieceCount = atoi(av[1]);
 			pieceState = 0;
+			pieceTime = -1;
+		}
+		else if (!strcmp(av[0], "TickLength") && ac >= 2)
+			tickLength = atof(av[1]);
+		else if (!strcmp(av[0], "GameType") && ac >= 2) {
+			twoPlayer = !strcmp(av[1], "ClassicTwo");
+			oppKnown = 0;
 		}
 		else if (!strcmp(av[0], "BoardSize") && ac >= 4) {
-			if (atoi(av[1]) != 0)
+			if (atoi(av[1]) != 0) {
+				memset(oppRows, 0, sizeof(oppRows));
+				oppKnown = atoi(av[1]) == 1 && atoi(av[2]) == boardHeight
+					&& atoi(av[3]) == boardWidth;
 				continue;
+			}
 			boardHeight = atoi(av[2]);
 			boardWidth = atoi(av[3]);
+			fullRow = boardWidth < 32 ? (1U << boardWidth) - 1 : ~0U;
+			if (net && net->width != boardWidth) {
+				WriteLine("Message Network is for width %d, "
+						"using BoardScore\n", net->width);
+				net = NULL;
+			}
 		}
 		else if (!strcmp(av[0], "RowUpdate") && ac >= 3 + boardWidth) {
 			int scr, row, col;
 
 			scr = atoi(av[1]);
+			row = atoi(av[2]);
+			if (row < 0 || row >= MAX_BOARD_HEIGHT)
+				continue;
+			if (scr == 1) {
+				oppRows[row] = 0;
+				for (col = 0; col < boardWidth; col++)
+					if (atoi(av[3 + col]) > 0)
+						oppRows[row] |= 1U << col;
+				continue;
+			}
 			if (scr != 0)
 				continue;
-			row = atoi(av[2]);
+			rows[row] = 0;
 			for (col = 0; col < boardWidth; col++)
-				board[row][col] = atoi(av[3 + col]);
+				if ((board[row][col] = atoi(av[3 + col])) > 0)
+					rows[row] |= 1U << col;
 		}
 		else if (!strcmp(av[0], "UserKey") && ac >= 3) {
 			char key;
@@ -408,7 +648,9 @@ int main(int argc, char **argv)
 				case 'v':
 				case 's':
 					FindPiece();
-					WriteLine("Message Score = %g\n", PeekScore(key == 'v'));
+					if (pieceShape >= 0)
+						WriteLine("Message Score = %g\n",
+								PeekScore(key == 'v'));
 					break;
 				case 'e':
 					masterEnable = !masterEnable;
@@ -418,6 +660,9 @@ int main(int argc, char **argv)
 					dropEnable = !dropEnable;
 					WriteLine("Message Drop Enable = %d\n", dropEnable);
 					break;
+				case 't':
+					TableStats();
+					break;
 				default:
 					if (strcmp(av[2], "?"))
 						WriteLine("%s %d\n", av[2], pieceCount);
@@ -426,16 +671,18 @@ int main(int argc, char **argv)
 		}
 		else if (!strcmp(av[0], "TimeStamp") && ac >= 2 && masterEnable) {
 			curTime = atof(av[1]);
-			FindPiece();
-			if (pieceVisible < 4)
+			if (netShape >= 0)
+				ShapePiece();
+			else
+				FindPiece();
+			if (pieceVisible < 4 || pieceShape < 0)
 				continue;
-			if (memcmp(piece, pieceLast, sizeof(piece)) ||
-					pieceLeft != pieceLeftLast) {
-				if (pieceState == 2)
-					pieceState = 1;
-				memcpy(pieceLast, piece, sizeof(piece));
-				pieceLeftLast = pieceLeft;
-			}
+			if (pieceState == 2 && (pieceShape != pieceShapeLast
+					|| pieceLeft != pieceLeftLast
+					|| (moveLast >= MV_down && pieceBottom != pieceBottomLast)))
+				pieceState = 1;		/* The last key has moved the piece */
+			if (pieceTime < 0)
+				pieceTime = curTime;
 			if (pieceState == 0) {		/* Undecided */
 				MakeDecision();
 				pieceState = 1;
@@ -445,23 +692,27 @@ int main(int argc, char **argv)
 					pieceState = 1;
 			}
 			if (pieceState == 1) {		/* Decided */
-				if (memcmp(piece, pieceDest, sizeof(piece))) {
-					WriteLine("Rotate %d\n", pieceCount);
-					pieceState = 2;
-				}
-				else if (pieceLeft != leftDest) {
-					if (pieceLeft < leftDest)
-						WriteLine("Right %d\n", pieceCount);
-					else
-						WriteLine("Left %d\n", pieceCount);
-					pieceState = 2;
+				int move;
+
+				if ((move = NextMove()) < 0) {
+					MakeDecision();		/* The goal is out of reach now */
+					move = NextMove();
 				}
-				else if (dropEnable) {
-					WriteLine("Drop %d\n", pieceCount);
+				if (move < 0 || move == MV_none)
+					pieceState = 3;
+				else if (netShape >= 0 && Straight() && SendPlacement()) {
 					pieceState = 3;
+					moveTimeout = curTime + MoveTimeout();
+				}
+				else if (dropEnable || move < MV_down) {
+					WriteLine("%s %d\n", moveNames[move], pieceCount);
+					pieceShapeLast = pieceShape;
+					pieceLeftLast = pieceLeft;
+					pieceBottomLast = pieceBottom;
+					moveLast = move;
+					pieceState = 2;
+					moveTimeout = curTime + MoveTimeout();
 				}
-				if (pieceState == 2)
-					moveTimeout = curTime + 0.5;
 			}
 		}
 	}
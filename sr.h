@@ -0,0 +1,339 @@
+/*
+ * sr -- A sample robot for Netris
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+#ifndef SR_H
+#define SR_H
+
+/* Both of these should be at least twice the actual max */
+#define MAX_BOARD_WIDTH		32
+#define MAX_BOARD_HEIGHT	64
+
+/*
+ * The board is kept as one bit per column in each row, and sets of rows
+ * as one bit per row, so MAX_BOARD_WIDTH and MAX_BOARD_HEIGHT mustn't
+ * exceed the sizes of these.
+ */
+typedef unsigned int Row;
+typedef unsigned long long RowSet;
+
+#define RowBit(row)		((RowSet)1 << (row))
+
+/* Index of the lowest bit set in a Row */
+#define LowBit(x)		__builtin_ctz(x)
+
+/*
+ * The blocks of each shape relative to its position, indexed by the
+ * shape numbers used in "Piece" lines, along with the shape it rotates to
+ */
+typedef struct _ShapeCells {
+	int rotateTo;
+	int cell[4][2];		/* row, column */
+} ShapeCells;
+
+#define NUM_SHAPES	19
+
+extern ShapeCells shapes[NUM_SHAPES];
+
+/*
+ * Each shape as rows of bits, bottom row first, aligned to column 0.
+ * Precomputed by InitOrients.
+ */
+typedef struct _Orient {
+	Row rows[4];
+	int height, width;
+	int bottom, left;	/* Offset of bottom-left square from the position */
+	int next;			/* The shape after a turn in the search order */
+	int low[4], high[4];	/* Lowest and highest square in each column */
+} Orient;
+
+extern Orient orients[NUM_SHAPES];
+
+/*
+ * The pieces Netris chooses from (its stdOptions), as shape numbers
+ * with their weights
+ */
+typedef struct _PieceOption {
+	int weight;
+	int shape;
+} PieceOption;
+
+extern PieceOption nextOptions[];
+
+#define LOST_SCORE		1e6		/* Score when a piece doesn't fit */
+
+/*
+ * The weights of the evaluation, which the defaults in srsearch.c give
+ * the scores sr has always used.  The integer ones are added up by the
+ * batch kernel, so the tuner rounds them.
+ */
+typedef struct _Weights {
+	int rowFit;			/* Hardness of any row */
+	int cellFit;		/* Hardness of each empty square... */
+	int depthFit;		/* ...for each row it's above its column */
+	int fitWell;		/* ...between columns more than 2 higher */
+	int fitSide;		/* ...beside one column more than 2 higher */
+	int fitBoth2;		/* ...between steps of 2 */
+	int fitOne2;		/* ...beside one step of 2 */
+	int wellShape;		/* Top shape of a well more than 2 deep */
+	int wellStep;		/* ...for each 4 rows of its depth */
+	int sideShape, both2Shape, one2Shape;	/* Top shape, as for fit */
+	double space;		/* Each half of an empty square in a used row */
+	double closeToTop;	/* Times the square of the piece's height */
+	double fitProbs;	/* Times the hardness above empty squares */
+	double lineCleared;	/* Bonus for each line cleared */
+} Weights;
+
+#define NUM_WEIGHTS		16
+
+extern Weights weights;
+extern char *weightNames[NUM_WEIGHTS];
+
+/*
+ * The surface profile table classifies an empty square, or the top of
+ * a column, by the heights of the columns either side of it relative
+ * to it.  A difference is first put in a bucket: all those more than
+ * two below are alike, as are those more than two above but for a
+ * well's depth in steps of four.  The class of a pair of buckets is a
+ * Profile, with the steps above PROFILE_STEP.  A profile file is a
+ * ProfileHeader followed by the bucket of each difference from
+ * -MAX_BOARD_HEIGHT up and then the class of each pair, as made by
+ * srtune -T.
+ */
+#define PROFILE_MAGIC		"SRP1"
+#define PROFILE_RANGE		(2 * MAX_BOARD_HEIGHT + 1)
+#define PROFILE_BUCKETS		(6 + MAX_BOARD_HEIGHT / 4 + 1)
+#define PROFILE_SIZE		(PROFILE_RANGE + PROFILE_BUCKETS * PROFILE_BUCKETS)
+#define PROFILE_STEP		3
+
+typedef enum _Profile { PR_flat, PR_well, PR_side, PR_both2, PR_one2,
+	PR_count } Profile;
+
+typedef struct _ProfileHeader {
+	char magic[4];
+	int range, buckets;
+} ProfileHeader;
+
+/*
+ * Boards waiting to be scored by BatchScore, stored one candidate per
+ * lane so the kernel can work on several of them at a time.  The arrays
+ * used by the kernel come first so every group of lanes is aligned, and
+ * the batch is padded to a multiple of the widest kernel's LANES.
+ */
+#define BATCH_MAX	(4 * MAX_BOARD_WIDTH)
+#define LANES		8
+
+typedef struct _Batch {
+	Row rows[MAX_BOARD_HEIGHT][BATCH_MAX];
+	int hardFit[MAX_BOARD_HEIGHT][BATCH_MAX];
+	int count[MAX_BOARD_HEIGHT][BATCH_MAX];
+	int maxHeight[BATCH_MAX], topShape[BATCH_MAX];
+	int linesCleared[BATCH_MAX], pRow[BATCH_MAX];
+	double score[BATCH_MAX];
+	int n;
+	int rowsUsed;		/* Highest non-empty row in any board, plus one */
+} __attribute__((aligned(32))) Batch;
+
+/*
+ * Features of a board before a piece is placed, computed by
+ * BaseFeatures so PlacementScore only has to redo what a placement
+ * changes.  A placement only changes the heights of the columns it
+ * covers, which only changes the fit of squares in those columns and
+ * their neighbours, and only changes the dependencies of rows at or
+ * below its top.
+ */
+typedef struct _Base {
+	int maxHeight;
+	int height[MAX_BOARD_WIDTH];
+	int shape[MAX_BOARD_WIDTH];		/* ColumnShape of each column */
+	int topShape;
+	int count[MAX_BOARD_HEIGHT];	/* Empty squares in each row */
+	int fit[MAX_BOARD_HEIGHT][MAX_BOARD_WIDTH];	/* CellFit, 0 if full */
+	int fitSum[MAX_BOARD_HEIGHT];
+	RowSet depend[MAX_BOARD_HEIGHT];
+	RowSet column[MAX_BOARD_WIDTH];	/* Rows with a block in each column */
+	int fitAdd[PR_count], shapeAdd[PR_count];
+} Base;
+
+/*
+ * Scratch space for searching, one for each thread
+ */
+typedef struct _Search {
+	Batch batch;
+	Base base;			/* Of the board ScorePlacements last scored */
+	Row board[MAX_BOARD_HEIGHT];
+	long probes, hits, stores, overwrites;	/* Transposition table */
+} Search;
+
+typedef struct _Placement {
+	int shape, row, col;
+	double score;
+} Placement;
+
+typedef enum _Kernel { K_scalar, K_sse2, K_avx2 } Kernel;
+
+/*
+ * A network which can score boards instead of BoardScore, with one
+ * hidden layer of rectified units.  Its inputs are the height and the
+ * number of holes of each column, then the lines cleared and the row
+ * the piece came to rest at.  A network file is a NetHeader followed by
+ * the floats w1 (a row of inputs for each hidden unit), b1, w2 and b2,
+ * in the machine's byte order.
+ */
+#define NET_MAGIC			"SRN1"
+#define NetInputs(width)	(2 * (width) + 2)
+
+typedef struct _NetHeader {
+	char magic[4];
+	int width, inputs, hidden;
+} NetHeader;
+
+typedef struct _Net {
+	int width, inputs, hidden;
+	float *w1, *b1, *w2, *b2;
+} Net;
+
+/*
+ * A binary log (sr -L) is a LogHeader followed by records, each a
+ * LogRecord and then length bytes of text without a newline.  type is
+ * ' ' for a line read, '>' for one written and '#' for a note, and
+ * time is in microseconds since the log was opened, modulo 2^32.
+ */
+#define LOG_MAGIC			"SRL1"
+
+typedef struct _LogHeader {
+	char magic[4];
+	int version;
+} LogHeader;
+
+typedef struct _LogRecord {
+	unsigned int time;
+	unsigned short length;
+	unsigned char type, spare;
+} LogRecord;
+
+/*
+ * The keys the move generator uses.  MV_none marks where it started,
+ * and NOT_REACHED a position it couldn't get to.
+ */
+typedef enum _Move { MV_left, MV_right, MV_rotate, MV_down, MV_drop,
+	MV_none } Move;
+
+#define NOT_REACHED		0xff
+#define MAX_PLACEMENTS	512
+#define MAX_PATH		(4 * MAX_BOARD_HEIGHT * MAX_BOARD_WIDTH)
+
+/*
+ * Where a piece can go from its starting position.  fits has a bit for
+ * each row the piece fits at in each column, and move and from give
+ * the last key on the shortest way to each position and where it was
+ * pressed.
+ */
+typedef struct _MoveGen {
+	RowSet fits[NUM_SHAPES][MAX_BOARD_WIDTH];
+	unsigned char move[NUM_SHAPES][MAX_BOARD_HEIGHT][MAX_BOARD_WIDTH];
+	int from[NUM_SHAPES][MAX_BOARD_HEIGHT][MAX_BOARD_WIDTH];
+	int queue[MAX_PATH];
+	int top;			/* Rows the piece may be moved in */
+} MoveGen;
+
+typedef void JobFunc(Search *search, int item);
+
+extern int boardHeight, boardWidth;
+extern Row fullRow;
+
+extern int searchDepth, beamWidth;
+extern struct timeval deadline;
+extern volatile int outOfTime;
+extern int tableAge;
+
+extern Kernel kernel;
+extern Net *net;
+extern unsigned char *profile;
+extern int numThreads;
+extern Search *searches;
+
+/* srsearch.c */
+extern int min(int a, int b);
+extern void InitOrients(void);
+extern void MakeProfile(unsigned char *table);
+extern void InitProfile(char *name);
+extern double GetWeight(Weights *w, int i);
+extern void SetWeight(Weights *w, int i, double value);
+extern int IntegerWeight(int i);
+extern void ReadWeights(char *name, Weights *w);
+extern void WriteWeights(FILE *file, Weights *w);
+extern void ShapePicture(int shape, int pic[4][4], int *bottom, int *left);
+extern int PictureShape(int pic[4][4]);
+extern int PieceFits(Row *brd, int shape, int row, int col);
+extern int SimPlacement(Row *brd, Row *result, int shape, int row, int col);
+extern int ColumnHeights(Row *brd, int *height);
+extern int AddJunk(Row *brd, int count, int column);
+extern double BoardScore(Row *brd, int linesCleared, int pRow, int verbose);
+extern void BaseFeatures(Search *search, Row *brd);
+extern double PlacementScore(Search *search, Row *brd, int shape, int row,
+				int col, int leaf);
+extern void BatchAdd(Search *search, Row *brd, int shape, int row, int col);
+extern void BatchScore(Search *search);
+extern void InitKernel(char *name);
+extern void RunJob(JobFunc *func, int items);
+extern void InitThreads(int threads);
+extern int ListPlacements(Row *brd, int shape, int bottom, Placement *list);
+extern void ScorePlacements(Search *search, Row *brd, Placement *list, int n);
+extern int BestPlacements(Placement *list, int n, int *best, int width);
+extern int OutOfTime(void);
+extern void InitTable(int megabytes, char *policy);
+extern void TableStats(void);
+extern double PieceValue(Search *search, Row *brd, RowSet hash,
+				int shape, int depth);
+extern double Lookahead(Search *search, Row *brd, int depth);
+extern double LeafScore(Row *brd);
+extern double PlacedLeafScore(Search *search, Row *brd, Placement *p,
+				Row *result);
+extern int NetrisRandom(int *seed, int min, int max1);
+extern int ChoosePiece(int *seed);
+extern double Rollout(Row *brd, int seed, int pieces, int *played);
+
+/* srmove.c */
+extern char *moveNames[];
+extern int ReachablePlacements(MoveGen *gen, Row *brd, int shape, int row,
+				int col, Placement *list, int max);
+extern int MovePath(MoveGen *gen, int shape, int row, int col, Move *path);
+
+/* srnet.c */
+extern void LoadNet(char *name);
+extern void NetFeatures(Row *brd, int linesCleared, int pRow, float *x);
+extern double NetBoardScore(Row *brd, int linesCleared, int pRow);
+
+/* srlog.c */
+extern int binaryLog;
+extern void OpenLog(char *name);
+extern void AppendLog(int type, char *text, int length);
+extern void CloseLog(void);
+
+/* Supplied by the program */
+extern int WriteLine(char *fmt, ...);
+
+#endif /* SR_H */
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
@@ -0,0 +1,185 @@
+/*
+ * sr -- A sample robot for Netris
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+/*
+ * The batch evaluation kernels, included by srsearch.c once for each
+ * vector width with Lanes, FloatLanes, KERNEL_LANES, BatchKernel,
+ * NetKernel, Neighbours and KernelTarget defined.  Each lane of a vector
+ * is a different board.
+ */
+
+#define LaneVec(array, g)	(*(Lanes *)&(array)[(g) * KERNEL_LANES])
+
+/*
+ * Add the classification shared by CellFit and ColumnShape to sum,
+ * given the values to add when both neighbours are more than two
+ * higher, when one is, when both are two away and when one is.
+ * Vectors are passed by address to keep them out of the calling
+ * convention.
+ */
+static inline __attribute__((always_inline)) KernelTarget
+void Neighbours(Lanes *sum, Lanes *deltaLeft, Lanes *deltaRight, Lanes *add)
+{
+	Lanes left = *deltaLeft > 2, right = *deltaRight > 2;
+	Lanes left2 = (*deltaLeft == 2) | (*deltaLeft == -2);
+	Lanes right2 = (*deltaRight == 2) | (*deltaRight == -2);
+	Lanes neither = ~(left | right);
+
+	*sum += (left & right & add[0]) | ((left ^ right) & add[1])
+		| (neither & left2 & right2 & add[2])
+		| (neither & (left2 ^ right2) & add[3]);
+}
+
+/*
+ * Heights, top shape, hardness of fit and empty squares of the first
+ * n boards in a batch.  Same sums as BoardScore, a column at a time.
+ */
+KernelTarget
+void BatchKernel(Batch *batch, int n)
+{
+	Lanes height[MAX_BOARD_WIDTH];
+	Lanes maxHeight, topShape, bits, mask, edge, r;
+	Lanes deltaLeft, deltaRight, depth, fit, both, hardFit, count;
+	Lanes shapeAdd[4], fitAdd[4], wellShape, wellStep, cellFit, depthFit;
+	int g, row, col;
+
+	edge = (Lanes){} + MAX_BOARD_HEIGHT;
+	wellShape = (Lanes){} + weights.wellShape;
+	wellStep = (Lanes){} + weights.wellStep;
+	cellFit = (Lanes){} + weights.cellFit;
+	depthFit = (Lanes){} + weights.depthFit;
+	shapeAdd[1] = (Lanes){} + weights.sideShape;
+	shapeAdd[2] = (Lanes){} + weights.both2Shape;
+	shapeAdd[3] = (Lanes){} + weights.one2Shape;
+	fitAdd[0] = (Lanes){} + weights.fitWell;
+	fitAdd[1] = (Lanes){} + weights.fitSide;
+	fitAdd[2] = (Lanes){} + weights.fitBoth2;
+	fitAdd[3] = (Lanes){} + weights.fitOne2;
+	for (g = 0; g < n / KERNEL_LANES; ++g) {
+		for (col = 0; col < boardWidth; ++col)
+			height[col] = (Lanes){};
+		for (row = 0; row < batch->rowsUsed; ++row) {
+			bits = LaneVec(batch->rows[row], g);
+			r = (Lanes){} + row + 1;
+			for (col = 0; col < boardWidth; ++col) {
+				mask = -((bits >> col) & 1);
+				height[col] = (height[col] & ~mask) | (r & mask);
+			}
+		}
+
+		maxHeight = topShape = (Lanes){};
+		for (col = 0; col < boardWidth; ++col) {
+			mask = height[col] > maxHeight;
+			maxHeight = (maxHeight & ~mask) | (height[col] & mask);
+			deltaLeft = col > 0 ? height[col - 1] - height[col] : edge;
+			deltaRight = col < boardWidth - 1
+				? height[col + 1] - height[col] : edge;
+			mask = deltaLeft < deltaRight;
+			both = (deltaLeft & mask) | (deltaRight & ~mask);
+			shapeAdd[0] = wellShape + (both >> 2) * wellStep;
+			Neighbours(&topShape, &deltaLeft, &deltaRight, shapeAdd);
+		}
+		LaneVec(batch->maxHeight, g) = maxHeight;
+		LaneVec(batch->topShape, g) = topShape;
+
+		for (row = 0; row < batch->rowsUsed; ++row) {
+			bits = LaneVec(batch->rows[row], g);
+			r = (Lanes){} + row;
+			hardFit = (Lanes){} + weights.rowFit;
+			count = (Lanes){};
+			for (col = 0; col < boardWidth; ++col) {
+				mask = ((bits >> col) & 1) - 1;
+				depth = r - height[col];
+				depth &= depth > 0;
+				deltaLeft = col > 0 ? height[col - 1] - r : edge;
+				deltaRight = col < boardWidth - 1 ? height[col + 1] - r : edge;
+				fit = cellFit + depth * depthFit;
+				Neighbours(&fit, &deltaLeft, &deltaRight, fitAdd);
+				hardFit += fit & mask;
+				count -= mask;
+			}
+			LaneVec(batch->hardFit[row], g) = hardFit;
+			LaneVec(batch->count[row], g) = count;
+		}
+	}
+}
+
+/*
+ * Score the first n boards in a batch with the network, adding up in
+ * the same order as NetBoardScore.  There's no fused multiply-add, so
+ * each kernel gives the same scores.
+ */
+KernelTarget
+void NetKernel(Batch *batch, int n)
+{
+	Lanes height[MAX_BOARD_WIDTH], holes[MAX_BOARD_WIDTH];
+	Lanes bits, mask, r;
+	FloatLanes x[NetInputs(MAX_BOARD_WIDTH)], sum, out;
+	float *w;
+	int g, row, col, h, i;
+
+	for (g = 0; g < n / KERNEL_LANES; ++g) {
+		for (col = 0; col < boardWidth; ++col)
+			height[col] = holes[col] = (Lanes){};
+		for (row = 0; row < batch->rowsUsed; ++row) {
+			bits = LaneVec(batch->rows[row], g);
+			r = (Lanes){} + row + 1;
+			for (col = 0; col < boardWidth; ++col) {
+				mask = -((bits >> col) & 1);
+				height[col] = (height[col] & ~mask) | (r & mask);
+			}
+		}
+		for (row = 0; row < batch->rowsUsed; ++row) {
+			bits = LaneVec(batch->rows[row], g);
+			r = (Lanes){} + row;
+			for (col = 0; col < boardWidth; ++col)
+				holes[col] -= (((bits >> col) & 1) - 1) & (r < height[col]);
+		}
+		for (col = 0; col < boardWidth; ++col) {
+			x[col] = __builtin_convertvector(height[col], FloatLanes);
+			x[boardWidth + col] = __builtin_convertvector(holes[col],
+					FloatLanes);
+		}
+		x[2 * boardWidth] = __builtin_convertvector(
+				LaneVec(batch->linesCleared, g), FloatLanes);
+		x[2 * boardWidth + 1] = __builtin_convertvector(
+				LaneVec(batch->pRow, g), FloatLanes);
+
+		out = (FloatLanes){} + net->b2[0];
+		w = net->w1;
+		for (h = 0; h < net->hidden; ++h, w += net->inputs) {
+			sum = (FloatLanes){} + net->b1[h];
+			for (i = 0; i < net->inputs; ++i)
+				sum += w[i] * x[i];
+			sum = (FloatLanes)((Lanes)sum & (sum > 0));
+			out += net->w2[h] * sum;
+		}
+		for (i = 0; i < KERNEL_LANES; ++i)
+			batch->score[g * KERNEL_LANES + i] = out[i];
+	}
+}
+
+#undef LaneVec
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
@@ -0,0 +1,191 @@
+/*
+ * sr -- A sample robot for Netris
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+
+/*
+ * The binary log.  Lines are copied into a ring buffer, and a thread
+ * writes it out, so logging doesn't make the robot wait for the disk.
+ * If the ring fills up, lines are dropped and a note says how many.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "sr.h"
+
+#define RING_SIZE		(1 << 20)
+#define FLUSH_MS		200		/* Longest a line waits to be written */
+
+int binaryLog;
+
+static FILE *ringFile;
+static char ring[RING_SIZE];
+static unsigned long ringHead, ringTail;	/* Bytes appended and written */
+static int dropped, closing;
+static struct timeval opened;
+static pthread_mutex_t ringLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ringFull = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+
+/*
+ * Copy into the ring at ringHead, which must have room
+ */
+static void RingCopy(void *data, int length)
+{
+	int at = ringHead % RING_SIZE, part = RING_SIZE - at;
+
+	if (part > length)
+		part = length;
+	memcpy(ring + at, data, part);
+	memcpy(ring, (char *)data + part, length - part);
+	ringHead += length;
+}
+
+/*
+ * Append a record to the ring, or count it as dropped if there's no
+ * room.  ringLock must be held.
+ */
+static int RingRecord(int type, char *text, int length)
+{
+	struct timeval now;
+	LogRecord record;
+
+	if (RING_SIZE - (ringHead - ringTail) < sizeof(record) + length)
+		return 0;
+	gettimeofday(&now, NULL);
+	record.time = (now.tv_sec - opened.tv_sec) * 1000000UL
+		+ now.tv_usec - opened.tv_usec;
+	record.length = length;
+	record.type = type;
+	record.spare = 0;
+	RingCopy(&record, sizeof(record));
+	RingCopy(text, length);
+	return 1;
+}
+
+void AppendLog(int type, char *text, int length)
+{
+	char note[64];
+
+	if (length > 0xffff)
+		length = 0xffff;
+	pthread_mutex_lock(&ringLock);
+	if (dropped) {
+		sprintf(note, "%d lines dropped", dropped);
+		if (RingRecord('#', note, strlen(note)))
+			dropped = 0;
+	}
+	if (dropped || !RingRecord(type, text, length))
+		++dropped;
+	if (ringHead - ringTail > RING_SIZE / 2)
+		pthread_cond_signal(&ringFull);
+	pthread_mutex_unlock(&ringLock);
+}
+
+/*
+ * Write out the ring every FLUSH_MS, or sooner if it's half full.
+ * Only this thread moves ringTail, and appending never touches the
+ * bytes between it and ringHead, so they're written unlocked.
+ */
+static void *RingWriter(void *arg)
+{
+	struct timeval now;
+	struct timespec wake;
+	unsigned long head;
+	int at, part, done;
+
+	pthread_mutex_lock(&ringLock);
+	for (;;) {
+		done = closing;
+		head = ringHead;
+		pthread_mutex_unlock(&ringLock);
+		while (ringTail < head) {
+			at = ringTail % RING_SIZE;
+			part = RING_SIZE - at;
+			if (part > head - ringTail)
+				part = head - ringTail;
+			fwrite(ring + at, 1, part, ringFile);
+			pthread_mutex_lock(&ringLock);
+			ringTail += part;
+			pthread_mutex_unlock(&ringLock);
+		}
+		fflush(ringFile);
+		pthread_mutex_lock(&ringLock);
+		if (done)
+			break;
+		if (ringHead - ringTail <= RING_SIZE / 2 && !closing) {
+			gettimeofday(&now, NULL);
+			now.tv_usec += FLUSH_MS * 1000;
+			wake.tv_sec = now.tv_sec + now.tv_usec / 1000000;
+			wake.tv_nsec = now.tv_usec % 1000000 * 1000;
+			pthread_cond_timedwait(&ringFull, &ringLock, &wake);
+		}
+	}
+	pthread_mutex_unlock(&ringLock);
+	return NULL;
+}
+
+void OpenLog(char *name)
+{
+	LogHeader header;
+
+	if (!(ringFile = fopen(name, "w"))) {
+		perror(name);
+		exit(1);
+	}
+	memcpy(header.magic, LOG_MAGIC, 4);
+	header.version = 1;
+	fwrite(&header, sizeof(header), 1, ringFile);
+	gettimeofday(&opened, NULL);
+	if (pthread_create(&writer, NULL, RingWriter, NULL)) {
+		perror("pthread_create");
+		exit(1);
+	}
+	binaryLog = 1;
+	atexit(CloseLog);
+
+	/* Netris may be gone before our last reply; read to the end anyway */
+	signal(SIGPIPE, SIG_IGN);
+}
+
+/*
+ * Write out what's left in the ring and close the log
+ */
+void CloseLog(void)
+{
+	if (!binaryLog)
+		return;
+	binaryLog = 0;
+	pthread_mutex_lock(&ringLock);
+	closing = 1;
+	pthread_cond_signal(&ringFull);
+	pthread_mutex_unlock(&ringLock);
+	pthread_join(writer, NULL);
+	fclose(ringFile);
+}
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
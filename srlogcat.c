@@ -0,0 +1,83 @@
+/*
+ * srlogcat -- Decodes the binary log of the sample robot
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+
+/*
+ * Prints a log written by sr -L as sr -l would have written it, with
+ * -t giving the seconds since the log was opened before each line
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sr.h"
+
+int main(int argc, char **argv)
+{
+	LogHeader header;
+	LogRecord record;
+	char text[0x10000];
+	double base = 0;
+	unsigned int last = 0;
+	int times = 0, ch;
+	FILE *file;
+
+	while ((ch = getopt(argc, argv, "t")) != -1)
+		switch (ch) {
+			case 't':
+				times = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: srlogcat [-t] [log]\n");
+				exit(1);
+		}
+	if (optind >= argc)
+		file = stdin;
+	else if (!(file = fopen(argv[optind], "r"))) {
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (fread(&header, sizeof(header), 1, file) != 1
+			|| memcmp(header.magic, LOG_MAGIC, 4) || header.version != 1) {
+		fprintf(stderr, "srlogcat: not a sample robot log\n");
+		exit(1);
+	}
+	while (fread(&record, sizeof(record), 1, file) == 1) {
+		if (fread(text, 1, record.length, file) != record.length) {
+			fprintf(stderr, "srlogcat: log is cut short\n");
+			exit(1);
+		}
+		if (times) {
+			if (record.time < last)
+				base += 4294967296.0;
+			last = record.time;
+			printf("%11.6f ", (base + record.time) / 1e6);
+		}
+		printf("%c %.*s\n", record.type, record.length, text);
+	}
+	return 0;
+}
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
@@ -0,0 +1,176 @@
+/*
+ * sr -- A sample robot for Netris
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+/*
+ * The move generator.  It searches breadth first over the positions a
+ * piece can reach with the keys Netris gives it, the way MovePiece,
+ * RotatePiece and DropPiece move it, so it finds placements under
+ * overhangs and turns after the piece has been moved down as well as
+ * straight drops.  Gravity only moves the piece down, which a key can
+ * do too, so it can't take the piece anywhere the search doesn't go.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sr.h"
+
+/* As the robot protocol names them */
+char *moveNames[] = { "Left", "Right", "Rotate", "Down", "Drop", NULL };
+
+#define State(shape, row, col) \
+	(((shape) * MAX_BOARD_HEIGHT + (row)) * MAX_BOARD_WIDTH + (col))
+
+/*
+ * Fill in the rows each of the piece's orientations fits at, a column
+ * at a time, from bit masks of the blocks in each column
+ */
+void FitMasks(MoveGen *gen, Row *brd, int shape)
+{
+	RowSet column[MAX_BOARD_WIDTH], collide;
+	int row, col, i, start = shape;
+	Row bits;
+
+	memset(column, 0, sizeof(column));
+	for (row = 0; row < boardHeight; ++row)
+		for (bits = brd[row]; bits; bits &= bits - 1)
+			column[LowBit(bits)] |= RowBit(row);
+	do {
+		for (col = 0; col < boardWidth; ++col) {
+			if (col + orients[shape].width > boardWidth) {
+				gen->fits[shape][col] = 0;
+				continue;
+			}
+			collide = 0;
+			for (i = 0; i < orients[shape].height; ++i)
+				for (bits = orients[shape].rows[i]; bits; bits &= bits - 1)
+					collide |= column[col + LowBit(bits)] >> i;
+			gen->fits[shape][col] = ~collide & (RowBit(gen->top) - 1);
+		}
+		memset(gen->move[shape], NOT_REACHED, sizeof(gen->move[shape]));
+		shape = shapes[shape].rotateTo;
+	} while (shape != start);
+}
+
+/*
+ * Search from a position, adding to list the first max places the
+ * piece can come to rest, nearest first.  Afterwards MovePath gives
+ * the keys to get to any of them.
+ */
+int ReachablePlacements(MoveGen *gen, Row *brd, int shape, int row, int col,
+				Placement *list, int max)
+{
+	int head = 0, tail = 0, n = 0, state, move, to;
+	int toShape, toRow, toCol;
+	RowSet fits, below;
+
+	gen->top = min(boardHeight + 4, MAX_BOARD_HEIGHT - 4);
+	FitMasks(gen, brd, shape);
+	if (row < 0 || row >= gen->top || col < 0 || col >= boardWidth
+			|| !(gen->fits[shape][col] & RowBit(row)))
+		return 0;
+	gen->move[shape][row][col] = MV_none;
+	gen->queue[tail++] = State(shape, row, col);
+	while (head < tail) {
+		state = gen->queue[head++];
+		col = state % MAX_BOARD_WIDTH;
+		row = state / MAX_BOARD_WIDTH % MAX_BOARD_HEIGHT;
+		shape = state / MAX_BOARD_WIDTH / MAX_BOARD_HEIGHT;
+		fits = gen->fits[shape][col];
+		below = ~fits & (RowBit(row) - 1);
+		if ((row == 0 || !(fits & RowBit(row - 1))) && row < boardHeight
+				&& n < max) {
+			list[n].shape = shape;
+			list[n].row = row;
+			list[n].col = col;
+			n++;
+		}
+		for (move = MV_left; move < MV_none; ++move) {
+			toShape = shape;
+			toRow = row;
+			toCol = col;
+			switch (move) {
+				case MV_left:
+					toCol--;
+					break;
+				case MV_right:
+					toCol++;
+					break;
+				case MV_rotate:
+					toShape = shapes[shape].rotateTo;
+					toRow += orients[toShape].bottom - orients[shape].bottom;
+					toCol += orients[toShape].left - orients[shape].left;
+					break;
+				case MV_down:
+					toRow--;
+					break;
+				case MV_drop:
+					toRow = below ? 64 - __builtin_clzll(below) : 0;
+					if (toRow >= row - 1)
+						continue;	/* Same as down */
+					break;
+			}
+			if (toRow < 0 || toRow >= gen->top || toCol < 0
+					|| toCol >= boardWidth
+					|| !(gen->fits[toShape][toCol] & RowBit(toRow))
+					|| gen->move[toShape][toRow][toCol] != NOT_REACHED)
+				continue;
+			to = State(toShape, toRow, toCol);
+			gen->move[toShape][toRow][toCol] = move;
+			gen->from[toShape][toRow][toCol] = state;
+			gen->queue[tail++] = to;
+		}
+	}
+	return n;
+}
+
+/*
+ * Put the keys to get to a position found by the last search in path,
+ * returning how many there are, or -1 if it can't be reached
+ */
+int MovePath(MoveGen *gen, int shape, int row, int col, Move *path)
+{
+	int n = 0, i, state;
+	Move move;
+
+	if (row < 0 || row >= gen->top || col < 0 || col >= boardWidth)
+		return -1;
+	while ((move = gen->move[shape][row][col]) != MV_none) {
+		if (move == NOT_REACHED)
+			return -1;
+		path[n++] = move;
+		state = gen->from[shape][row][col];
+		col = state % MAX_BOARD_WIDTH;
+		row = state / MAX_BOARD_WIDTH % MAX_BOARD_HEIGHT;
+		shape = state / MAX_BOARD_WIDTH / MAX_BOARD_HEIGHT;
+	}
+	for (i = 0; i < n / 2; ++i) {
+		move = path[i];
+		path[i] = path[n - 1 - i];
+		path[n - 1 - i] = move;
+	}
+	return n;
+}
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
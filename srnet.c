@@ -0,0 +1,127 @@
+/*
+ * sr -- A sample robot for Netris
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+/*
+ * The network evaluator.  The file is mapped rather than read, so the
+ * weights are shared between robots using the same network.  Batches
+ * are scored by NetKernel in srkernel.h; NetBoardScore does one board
+ * the same way, with the sums in the same order so the scores agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sr.h"
+
+#define MAX_HIDDEN	4096
+
+Net *net;			/* NULL to use BoardScore */
+Net mappedNet;
+
+void LoadNet(char *name)
+{
+	NetHeader *header;
+	struct stat st;
+	void *map;
+	size_t size;
+	int fd;
+
+	if ((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(name);
+		exit(1);
+	}
+	if (st.st_size < sizeof(NetHeader)) {
+		fprintf(stderr, "sr: '%s' isn't a network file\n", name);
+		exit(1);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
+	header = map;
+	size = 0;
+	if (header->width >= 1 && header->width <= MAX_BOARD_WIDTH
+			&& header->inputs == NetInputs(header->width)
+			&& header->hidden >= 1 && header->hidden <= MAX_HIDDEN)
+		size = sizeof(NetHeader) + sizeof(float)
+			* ((size_t)(header->inputs + 2) * header->hidden + 1);
+	if (memcmp(header->magic, NET_MAGIC, 4) || size != st.st_size) {
+		fprintf(stderr, "sr: '%s' isn't a network file\n", name);
+		exit(1);
+	}
+	mappedNet.width = header->width;
+	mappedNet.inputs = header->inputs;
+	mappedNet.hidden = header->hidden;
+	mappedNet.w1 = (float *)(header + 1);
+	mappedNet.b1 = mappedNet.w1 + header->inputs * header->hidden;
+	mappedNet.w2 = mappedNet.b1 + header->hidden;
+	mappedNet.b2 = mappedNet.w2 + header->hidden;
+	net = &mappedNet;
+}
+
+/*
+ * The network's inputs for a board, as in sr.h
+ */
+void NetFeatures(Row *brd, int linesCleared, int pRow, float *x)
+{
+	int height[MAX_BOARD_WIDTH];
+	int row, col, holes;
+
+	ColumnHeights(brd, height);
+	for (col = 0; col < boardWidth; ++col) {
+		holes = 0;
+		for (row = 0; row < height[col]; ++row)
+			holes += !(brd[row] & (1U << col));
+		x[col] = height[col];
+		x[boardWidth + col] = holes;
+	}
+	x[2 * boardWidth] = linesCleared;
+	x[2 * boardWidth + 1] = pRow;
+}
+
+double NetBoardScore(Row *brd, int linesCleared, int pRow)
+{
+	float x[NetInputs(MAX_BOARD_WIDTH)], sum, out;
+	float *w = net->w1;
+	int h, i;
+
+	NetFeatures(brd, linesCleared, pRow, x);
+	out = net->b2[0];
+	for (h = 0; h < net->hidden; ++h, w += net->inputs) {
+		sum = net->b1[h];
+		for (i = 0; i < net->inputs; ++i)
+			sum += w[i] * x[i];
+		out += net->w2[h] * (sum > 0 ? sum : 0);
+	}
+	return out;
+}
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
@@ -0,0 +1,1483 @@
+/*
+ * sr -- A sample robot for Netris
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "sr.h"
+
+ShapeCells shapes[NUM_SHAPES] = {
+	{  1, { { 0, -1}, { 0,  0}, { 0,  1}, { 0,  2} } },
+	{  0, { { 1,  0}, { 0,  0}, {-1,  0}, {-2,  0} } },
+	{  2, { { 0,  0}, {-1,  0}, {-1, -1}, { 0, -1} } },
+	{  4, { { 0,  1}, { 0,  0}, { 0, -1}, {-1, -1} } },
+	{  5, { { 1,  0}, { 0,  0}, {-1,  0}, {-1,  1} } },
+	{  6, { { 0, -1}, { 0,  0}, { 0,  1}, { 1,  1} } },
+	{  3, { {-1,  0}, { 0,  0}, { 1,  0}, { 1, -1} } },
+	{  8, { { 0, -1}, { 0,  0}, { 0,  1}, {-1,  1} } },
+	{  9, { {-1,  0}, { 0,  0}, { 1,  0}, { 1,  1} } },
+	{ 10, { { 0,  1}, { 0,  0}, { 0, -1}, { 1, -1} } },
+	{  7, { { 1,  0}, { 0,  0}, {-1,  0}, {-1, -1} } },
+	{ 12, { { 0,  0}, {-1,  0}, { 0, -1}, { 0,  1} } },
+	{ 13, { { 0,  0}, { 0,  1}, {-1,  0}, { 1,  0} } },
+	{ 14, { { 0,  0}, { 1,  0}, { 0,  1}, { 0, -1} } },
+	{ 11, { { 0,  0}, { 0, -1}, { 1,  0}, {-1,  0} } },
+	{ 16, { { 0, -1}, { 0,  0}, { 1,  0}, { 1,  1} } },
+	{ 15, { { 1,  0}, { 0,  0}, { 0,  1}, {-1,  1} } },
+	{ 18, { { 0, -1}, { 0,  0}, {-1,  0}, {-1,  1} } },
+	{ 17, { { 1,  0}, { 0,  0}, { 0, -1}, {-1, -1} } },
+};
+
+Orient orients[NUM_SHAPES];
+
+/*
+ * Netris doesn't tell robots the next piece, so the lookahead takes the
+ * expected score over these
+ */
+PieceOption nextOptions[] = {
+	{ 1,  0 }, { 1,  2 }, { 1,  3 }, { 1,  7 },
+	{ 1, 11 }, { 1, 15 }, { 1, 17 }, { 0, 0 }
+};
+
+int boardHeight, boardWidth;
+Row fullRow;
+
+Weights weights = {
+	5, 1, 1, 7, 2, 2, 3,
+	15, 15, 2, 2, 3,
+	0.25, 200, 1, 10
+};
+
+char *weightNames[NUM_WEIGHTS] = {
+	"rowFit", "cellFit", "depthFit", "fitWell", "fitSide", "fitBoth2",
+	"fitOne2", "wellShape", "wellStep", "sideShape", "both2Shape",
+	"one2Shape", "space", "closeToTop", "fitProbs", "lineCleared"
+};
+
+#define IntWeight(field)	{ offsetof(Weights, field), 1 }
+#define RealWeight(field)	{ offsetof(Weights, field), 0 }
+
+static struct {
+	int offset;
+	int integer;
+} weightFields[NUM_WEIGHTS] = {
+	IntWeight(rowFit), IntWeight(cellFit), IntWeight(depthFit),
+	IntWeight(fitWell), IntWeight(fitSide), IntWeight(fitBoth2),
+	IntWeight(fitOne2), IntWeight(wellShape), IntWeight(wellStep),
+	IntWeight(sideShape), IntWeight(both2Shape), IntWeight(one2Shape),
+	RealWeight(space), RealWeight(closeToTop), RealWeight(fitProbs),
+	RealWeight(lineCleared)
+};
+
+int searchDepth = 3;	/* Most pieces to look ahead, including the current */
+int beamWidth = 4;		/* Placements expanded for each piece */
+struct timeval deadline;
+volatile int outOfTime;
+
+int numThreads = 1;
+Search *searches;
+
+Kernel kernel;
+char *kernelNames[] = { "scalar", "sse2", "avx2", NULL };
+
+int min(int a, int b)
+{
+	return a < b ? a : b;
+}
+
+double GetWeight(Weights *w, int i)
+{
+	char *field = (char *)w + weightFields[i].offset;
+
+	if (weightFields[i].integer)
+		return *(int *)field;
+	return *(double *)field;
+}
+
+int IntegerWeight(int i)
+{
+	return weightFields[i].integer;
+}
+
+/*
+ * Set weight i, rounding it if it's an integer
+ */
+void SetWeight(Weights *w, int i, double value)
+{
+	char *field = (char *)w + weightFields[i].offset;
+
+	if (weightFields[i].integer)
+		*(int *)field = value < 0 ? -(int)(-value + 0.5) : (int)(value + 0.5);
+	else
+		*(double *)field = value;
+}
+
+/*
+ * Read "name value" lines into w.  Weights not mentioned keep their
+ * values and lines starting with '#' are ignored.
+ */
+void ReadWeights(char *name, Weights *w)
+{
+	FILE *file;
+	char line[256], field[64];
+	double value;
+	int i;
+
+	if (!(file = fopen(name, "r"))) {
+		perror(name);
+		exit(1);
+	}
+	while (fgets(line, sizeof line, file)) {
+		if (line[0] == '#' || sscanf(line, "%63s %lf", field, &value) != 2)
+			continue;
+		for (i = 0; i < NUM_WEIGHTS; ++i)
+			if (!strcmp(field, weightNames[i]))
+				break;
+		if (i >= NUM_WEIGHTS) {
+			fprintf(stderr, "%s: unknown weight '%s'\n", name, field);
+			exit(1);
+		}
+		SetWeight(w, i, value);
+	}
+	fclose(file);
+}
+
+void WriteWeights(FILE *file, Weights *w)
+{
+	int i;
+
+	for (i = 0; i < NUM_WEIGHTS; ++i)
+		fprintf(file, "%s %.17g\n", weightNames[i], GetWeight(w, i));
+}
+
+/*
+ * Get the bottom-left aligned picture of a shape, and the offset of
+ * its bottom-left square from the shape's position
+ */
+void ShapePicture(int shape, int pic[4][4], int *bottom, int *left)
+{
+	int i;
+
+	*bottom = *left = 4;
+	for (i = 0; i < 4; ++i) {
+		*bottom = min(*bottom, shapes[shape].cell[i][0]);
+		*left = min(*left, shapes[shape].cell[i][1]);
+	}
+	memset(pic, 0, sizeof(int[4][4]));
+	for (i = 0; i < 4; ++i)
+		pic[shapes[shape].cell[i][0] - *bottom]
+			[shapes[shape].cell[i][1] - *left] = 1;
+}
+
+/*
+ * Turn a bottom-left aligned picture a quarter turn, keeping it aligned
+ */
+void RotatePicture(int pic[4][4])
+{
+	int pic2[4][4];
+	int row, col, height = 0;
+
+	for (row = 0; row < 4; ++row)
+		for (col = 0; col < 4; ++col)
+		{
+			pic2[row][col] = pic[row][col];
+			pic[row][col] = 0;
+			if (pic2[row][col])
+				height = row + 1;
+		}
+	for (row = 0; row < 4; ++row)
+		for (col = 0; col < height; ++col)
+			pic[row][col] = pic2[height - col - 1][row];
+}
+
+int PictureShape(int pic[4][4])
+{
+	int shape, row;
+	int rowBits;
+
+	for (shape = 0; shape < NUM_SHAPES; ++shape) {
+		for (row = 0; row < 4; ++row) {
+			rowBits = pic[row][0] | pic[row][1] << 1 | pic[row][2] << 2
+				| pic[row][3] << 3;
+			if (rowBits != orients[shape].rows[row])
+				break;
+		}
+		if (row == 4)
+			return shape;
+	}
+	return -1;
+}
+
+void InitOrients(void)
+{
+	int pic[4][4];
+	int shape, row, col;
+
+	for (shape = 0; shape < NUM_SHAPES; ++shape) {
+		ShapePicture(shape, pic, &orients[shape].bottom,
+				&orients[shape].left);
+		orients[shape].height = orients[shape].width = 0;
+		for (row = 0; row < 4; ++row) {
+			orients[shape].rows[row] = 0;
+			for (col = 0; col < 4; ++col)
+				if (pic[row][col]) {
+					orients[shape].rows[row] |= 1U << col;
+					orients[shape].height = row + 1;
+					if (orients[shape].width < col + 1)
+						orients[shape].width = col + 1;
+				}
+		}
+		for (col = 0; col < orients[shape].width; ++col) {
+			orients[shape].high[col] = -1;
+			for (row = 3; row >= 0; --row)
+				if (pic[row][col]) {
+					orients[shape].low[col] = row;
+					if (orients[shape].high[col] < 0)
+						orients[shape].high[col] = row;
+				}
+		}
+	}
+	for (shape = 0; shape < NUM_SHAPES; ++shape) {
+		ShapePicture(shape, pic, &row, &col);
+		RotatePicture(pic);
+		orients[shape].next = PictureShape(pic);
+	}
+}
+
+int PieceFits(Row *brd, int shape, int row, int col)
+{
+	int i;
+
+	if (row < 0 || col + orients[shape].width > boardWidth)
+		return 0;
+	for (i = 0; i < orients[shape].height && row + i < boardHeight; ++i)
+		if ((orients[shape].rows[i] << col) & brd[row + i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Fill in result with brd after placing a piece, returning the number
+ * of lines cleared
+ */
+int SimPlacement(Row *brd, Row *result, int shape, int row, int col)
+{
+	int i, from, to;
+	Row r;
+
+	memcpy(result, brd, boardHeight * sizeof(Row));
+	for (i = 0; i < orients[shape].height && row + i < boardHeight; ++i)
+		result[row + i] |= orients[shape].rows[i] << col;
+	for (from = to = 0; to < boardHeight; ++from) {
+		r = from < boardHeight ? result[from] : 0;
+		result[to] = r;
+		to += (r != fullRow);
+	}
+	return from - to;
+}
+
+/*
+ * Push brd up count rows and fill them with junk, with an empty square
+ * in column, the way Netris does.  Returns 1 if blocks went off the top.
+ */
+int AddJunk(Row *brd, int count, int column)
+{
+	int row, lost = 0;
+
+	if (count > boardHeight)
+		count = boardHeight;
+	for (row = boardHeight - count; row < boardHeight; ++row)
+		lost |= brd[row] != 0;
+	for (row = boardHeight - 1; row >= count; --row)
+		brd[row] = brd[row - count];
+	for (row = 0; row < count; ++row)
+		brd[row] = fullRow & ~(1U << column);
+	return lost;
+}
+
+/* Rows above row */
+#define RowsAbove(row)	(~(RowBit((row) + 1) - 1))
+
+unsigned char *profile;		/* The surface profile table, as in sr.h */
+static unsigned char madeProfile[PROFILE_SIZE];
+
+/* The class of a column whose neighbours differ from it by the deltas */
+#define ProfileClass(deltaLeft, deltaRight) \
+	profile[PROFILE_RANGE \
+		+ profile[(deltaLeft) + MAX_BOARD_HEIGHT] * PROFILE_BUCKETS \
+		+ profile[(deltaRight) + MAX_BOARD_HEIGHT]]
+
+/*
+ * Fill in a surface profile table
+ */
+void MakeProfile(unsigned char *table)
+{
+	int deltaLeft, deltaRight, class;
+	unsigned char *bucket = table + MAX_BOARD_HEIGHT;
+
+	for (deltaLeft = -MAX_BOARD_HEIGHT; deltaLeft <= MAX_BOARD_HEIGHT;
+			++deltaLeft)
+		if (deltaLeft < -2)
+			bucket[deltaLeft] = 0;
+		else if (deltaLeft <= 2)
+			bucket[deltaLeft] = deltaLeft + 3;
+		else
+			bucket[deltaLeft] = 6 + deltaLeft / 4;
+	for (deltaLeft = -MAX_BOARD_HEIGHT; deltaLeft <= MAX_BOARD_HEIGHT;
+			++deltaLeft)
+		for (deltaRight = -MAX_BOARD_HEIGHT; deltaRight <= MAX_BOARD_HEIGHT;
+				++deltaRight) {
+			if (deltaLeft > 2 && deltaRight > 2)
+				class = PR_well
+					| (min(deltaLeft, deltaRight) / 4) << PROFILE_STEP;
+			else if (deltaLeft > 2 || deltaRight > 2)
+				class = PR_side;
+			else if (abs(deltaLeft) == 2 && abs(deltaRight) == 2)
+				class = PR_both2;
+			else if (abs(deltaLeft) == 2 || abs(deltaRight) == 2)
+				class = PR_one2;
+			else
+				class = PR_flat;
+			table[PROFILE_RANGE + bucket[deltaLeft] * PROFILE_BUCKETS
+				+ bucket[deltaRight]] = class;
+		}
+}
+
+/*
+ * Map the surface profile table from a file made by srtune -T, or make
+ * it if name is NULL
+ */
+void InitProfile(char *name)
+{
+	ProfileHeader *header;
+	struct stat st;
+	void *map;
+	int fd, i;
+
+	if (!name) {
+		MakeProfile(madeProfile);
+		profile = madeProfile;
+		return;
+	}
+	if ((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(name);
+		exit(1);
+	}
+	if (st.st_size != sizeof(ProfileHeader) + PROFILE_SIZE) {
+		fprintf(stderr, "sr: '%s' isn't a profile file\n", name);
+		exit(1);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
+	header = map;
+	profile = (unsigned char *)(header + 1);
+	for (i = 0; i < PROFILE_RANGE; ++i)
+		if (profile[i] >= PROFILE_BUCKETS)
+			break;
+	/* The classes index fitAdd and shapeAdd, so check them too */
+	if (i == PROFILE_RANGE)
+		for (; i < PROFILE_SIZE; ++i)
+			if ((profile[i] & ((1 << PROFILE_STEP) - 1)) >= PR_count
+					|| profile[i] >> PROFILE_STEP > MAX_BOARD_HEIGHT / 4)
+				break;
+	if (memcmp(header->magic, PROFILE_MAGIC, 4) || i < PROFILE_SIZE
+			|| header->range != PROFILE_RANGE
+			|| header->buckets != PROFILE_BUCKETS) {
+		fprintf(stderr, "sr: '%s' isn't a profile file\n", name);
+		exit(1);
+	}
+}
+
+/*
+ * How much harder an empty square makes it to fill its row, given what
+ * each class of profile adds
+ */
+int CellFit(int *height, int row, int col, int *fitAdd)
+{
+	int fit = weights.cellFit;
+	int deltaLeft, deltaRight;
+
+	if (height[col] < row)
+		fit += (row - height[col]) * weights.depthFit;
+	if (col > 0)
+		deltaLeft = height[col - 1] - row;
+	else
+		deltaLeft = MAX_BOARD_HEIGHT;
+	if (col < boardWidth - 1)
+		deltaRight = height[col + 1] - row;
+	else
+		deltaRight = MAX_BOARD_HEIGHT;
+	return fit + fitAdd[ProfileClass(deltaLeft, deltaRight)
+		& ((1 << PROFILE_STEP) - 1)];
+}
+
+/*
+ * A column's share of the score based on top shape
+ */
+int ColumnShape(int *height, int col, int *shapeAdd)
+{
+	int deltaLeft, deltaRight, class;
+
+	if (col > 0)
+		deltaLeft = height[col - 1] - height[col];
+	else
+		deltaLeft = MAX_BOARD_HEIGHT;
+	if (col < boardWidth - 1)
+		deltaRight = height[col + 1] - height[col];
+	else
+		deltaRight = MAX_BOARD_HEIGHT;
+	class = ProfileClass(deltaLeft, deltaRight);
+	return shapeAdd[class & ((1 << PROFILE_STEP) - 1)]
+		+ weights.wellStep * (class >> PROFILE_STEP);
+}
+
+int MaxHard(RowSet depend, int *hardFit, int row, int maxHeight)
+{
+	int i, maxHard = 0;
+
+	for (i = row + 1; i < row + 5 && i < maxHeight; ++i)
+		if (depend & RowBit(i))
+			if (maxHard < hardFit[i])
+				maxHard = hardFit[i];
+	return maxHard;
+}
+
+double CombineScore(int spaceHalves, int pRow, int topShape,
+					double fitProbs, int linesCleared, int verbose)
+{
+	double closeToTop, space;
+
+	closeToTop = (pRow / (double)boardHeight);
+	closeToTop *= closeToTop;
+
+	closeToTop *= weights.closeToTop;
+	space = spaceHalves * weights.space;
+	fitProbs *= weights.fitProbs;
+
+	if (verbose) {
+		WriteLine("Message space=%g, close=%g, shape=%d\n",
+			space, closeToTop, topShape);
+		WriteLine("Message fitProbs=%g, cleared=%g\n",
+			fitProbs, -linesCleared * weights.lineCleared);
+	}
+
+	return space + closeToTop + topShape + fitProbs
+		- linesCleared * weights.lineCleared;
+}
+
+/*
+ * Fill in the heights of the columns of a board, returning the
+ * height of the highest
+ */
+int ColumnHeights(Row *brd, int *height)
+{
+	int row, maxHeight = 0;
+	Row seen = 0, bits;
+
+	memset(height, 0, boardWidth * sizeof(int));
+	for (row = boardHeight - 1; row >= 0 && seen != fullRow; --row)
+		if ((bits = brd[row] & ~seen)) {
+			if (!maxHeight)
+				maxHeight = row + 1;
+			seen |= bits;
+			for (; bits; bits &= bits - 1)
+				height[LowBit(bits)] = row + 1;
+		}
+	return maxHeight;
+}
+
+/*
+ * Compute the dependencies of a row, given those of the rows above it
+ * and the rows with a block in each column
+ */
+RowSet RowDepend(Row brdRow, RowSet *column, RowSet *depend,
+				int row, int maxHeight)
+{
+	RowSet result = 0;
+	Row bits;
+	int i;
+
+	for (bits = ~brdRow & fullRow; bits; bits &= bits - 1)
+		result |= column[LowBit(bits)] & RowsAbove(row);
+	for (i = row + 1; i < maxHeight; ++i)
+		if (result & RowBit(i))
+			result |= depend[i];
+	return result;
+}
+
+/*
+ * What each class of profile adds to CellFit and ColumnShape
+ */
+void ProfileAdds(int *fitAdd, int *shapeAdd)
+{
+	fitAdd[PR_flat] = shapeAdd[PR_flat] = 0;
+	fitAdd[PR_well] = weights.fitWell;
+	fitAdd[PR_side] = weights.fitSide;
+	fitAdd[PR_both2] = weights.fitBoth2;
+	fitAdd[PR_one2] = weights.fitOne2;
+	shapeAdd[PR_well] = weights.wellShape;
+	shapeAdd[PR_side] = weights.sideShape;
+	shapeAdd[PR_both2] = weights.both2Shape;
+	shapeAdd[PR_one2] = weights.one2Shape;
+}
+
+double BoardScore(Row *brd, int linesCleared, int pRow, int verbose)
+{
+	int maxHeight;
+	int height[MAX_BOARD_WIDTH];
+	int hardFit[MAX_BOARD_HEIGHT];
+	RowSet depend[MAX_BOARD_HEIGHT];
+	RowSet column[MAX_BOARD_WIDTH];
+	int row, col, count;
+	int fitAdd[PR_count], shapeAdd[PR_count];
+	int topShape = 0, spaceHalves = 0;
+	double fitProbs = 0;
+	Row bits;
+
+	ProfileAdds(fitAdd, shapeAdd);
+	maxHeight = ColumnHeights(brd, height);
+
+	/* Calculate dependencies */
+	memset(column, 0, boardWidth * sizeof(RowSet));
+	for (row = 0; row < maxHeight; ++row)
+		for (bits = brd[row]; bits; bits &= bits - 1)
+			column[LowBit(bits)] |= RowBit(row);
+	for (row = maxHeight - 1; row >= 0; --row)
+		depend[row] = RowDepend(brd[row], column, depend, row, maxHeight);
+
+	/* Calculate hardness of fit */
+	for (row = maxHeight - 1; row >= 0; --row) {
+		hardFit[row] = weights.rowFit;
+		count = 0;
+		for (bits = ~brd[row] & fullRow; bits; bits &= bits - 1) {
+			count++;
+			hardFit[row] += CellFit(height, row, LowBit(bits), fitAdd);
+		}
+		spaceHalves += boardWidth + count;
+		fitProbs += MaxHard(depend[row], hardFit, row, maxHeight) * count;
+	}
+
+	/* Calculate score based on top shape */
+	for (col = 0; col < boardWidth; ++col)
+		topShape += ColumnShape(height, col, shapeAdd);
+
+	return CombineScore(spaceHalves, pRow, topShape, fitProbs,
+			linesCleared, verbose);
+}
+
+void BaseFeatures(Search *search, Row *brd)
+{
+	Base *base = &search->base;
+	int row, col;
+	Row bits;
+
+	ProfileAdds(base->fitAdd, base->shapeAdd);
+	base->maxHeight = ColumnHeights(brd, base->height);
+	memset(base->column, 0, boardWidth * sizeof(RowSet));
+	for (row = 0; row < base->maxHeight; ++row)
+		for (bits = brd[row]; bits; bits &= bits - 1)
+			base->column[LowBit(bits)] |= RowBit(row);
+	for (row = base->maxHeight - 1; row >= 0; --row) {
+		base->depend[row] = RowDepend(brd[row], base->column, base->depend,
+				row, base->maxHeight);
+		base->count[row] = base->fitSum[row] = 0;
+		for (col = 0; col < boardWidth; ++col)
+			if (brd[row] & (1U << col))
+				base->fit[row][col] = 0;
+			else {
+				base->count[row]++;
+				base->fitSum[row] += base->fit[row][col] =
+					CellFit(base->height, row, col, base->fitAdd);
+			}
+	}
+	base->topShape = 0;
+	for (col = 0; col < boardWidth; ++col)
+		base->topShape += base->shape[col] =
+			ColumnShape(base->height, col, base->shapeAdd);
+}
+
+/*
+ * Score placing a piece on brd.  Same as SimPlacement followed by
+ * BoardScore, or by LeafScore if leaf is set, but reusing the features
+ * BaseFeatures found for brd unless lines are cleared.
+ */
+double PlacementScore(Search *search, Row *brd, int shape, int row, int col,
+					int leaf)
+{
+	Base *base = &search->base;
+	int maxHeight, top, lo, hi;
+	int height[MAX_BOARD_WIDTH];
+	int hardFit[MAX_BOARD_HEIGHT];
+	RowSet depend[MAX_BOARD_HEIGHT];
+	RowSet column[MAX_BOARD_WIDTH];
+	Row placed[4], brdRow, bits;
+	int r, c, i, count, fitSum, lines;
+	int topShape, spaceHalves = 0;
+	double fitProbs = 0;
+
+	top = row + orients[shape].height;
+	for (i = 0; i < orients[shape].height; ++i) {
+		placed[i] = orients[shape].rows[i] << col;
+		if (top > boardHeight || (brd[row + i] | placed[i]) == fullRow) {
+			lines = SimPlacement(brd, search->board, shape, row, col);
+			if (leaf)
+				return BoardScore(search->board, 0, 0, 0);
+			return BoardScore(search->board, lines, row, 0);
+		}
+	}
+
+	/* Heights and top shape */
+	memcpy(height, base->height, boardWidth * sizeof(int));
+	memcpy(column, base->column, boardWidth * sizeof(RowSet));
+	for (i = 0; i < orients[shape].height; ++i)
+		for (bits = placed[i]; bits; bits &= bits - 1) {
+			c = LowBit(bits);
+			if (height[c] < row + i + 1)
+				height[c] = row + i + 1;
+			column[c] |= RowBit(row + i);
+		}
+	maxHeight = top > base->maxHeight ? top : base->maxHeight;
+	lo = col > 0 ? col - 1 : 0;
+	hi = col + orients[shape].width;
+	if (hi > boardWidth - 1)
+		hi = boardWidth - 1;
+	topShape = base->topShape;
+	for (c = lo; c <= hi; ++c)
+		topShape += ColumnShape(height, c, base->shapeAdd) - base->shape[c];
+
+	for (r = maxHeight - 1; r >= 0; --r) {
+		brdRow = brd[r];
+		if (r >= row && r < top)
+			brdRow |= placed[r - row];
+		if (r >= base->maxHeight) {
+			count = fitSum = 0;
+			for (bits = ~brdRow & fullRow; bits; bits &= bits - 1) {
+				count++;
+				fitSum += CellFit(height, r, LowBit(bits), base->fitAdd);
+			}
+		}
+		else {
+			count = base->count[r];
+			fitSum = base->fitSum[r];
+			for (c = lo; c <= hi; ++c) {
+				fitSum -= base->fit[r][c];
+				if (!(brdRow & (1U << c)))
+					fitSum += CellFit(height, r, c, base->fitAdd);
+			}
+			if (r >= row && r < top)
+				count -= __builtin_popcount(placed[r - row]);
+		}
+		hardFit[r] = weights.rowFit + fitSum;
+		if (r >= top)
+			depend[r] = base->depend[r];
+		else
+			depend[r] = RowDepend(brdRow, column, depend, r, maxHeight);
+		spaceHalves += boardWidth + count;
+		fitProbs += MaxHard(depend[r], hardFit, r, maxHeight) * count;
+	}
+
+	return CombineScore(spaceHalves, leaf ? 0 : row, topShape, fitProbs,
+			0, 0);
+}
+
+/*
+ * Add brd after placing a piece to the batch
+ */
+void BatchAdd(Search *search, Row *brd, int shape, int row, int col)
+{
+	Batch *batch = &search->batch;
+	int n = batch->n++, i;
+
+	batch->linesCleared[n] = SimPlacement(brd, search->board, shape, row, col);
+	batch->pRow[n] = row;
+	for (i = 0; i < boardHeight; ++i)
+		if ((batch->rows[i][n] = search->board[i]) && batch->rowsUsed <= i)
+			batch->rowsUsed = i + 1;
+}
+
+#ifdef __GNUC__
+
+/*
+ * srkernel.h defines the kernels for one vector width, named by
+ * BatchKernel and NetKernel and with the instruction set given by
+ * KernelTarget
+ */
+typedef int Lanes4 __attribute__((vector_size(16)));
+typedef int Lanes8 __attribute__((vector_size(32)));
+typedef float Floats4 __attribute__((vector_size(16)));
+typedef float Floats8 __attribute__((vector_size(32)));
+
+#define Lanes			Lanes4
+#define FloatLanes		Floats4
+#define KERNEL_LANES	4
+#define BatchKernel		BatchKernelSSE2
+#define NetKernel		NetKernelSSE2
+#define Neighbours		NeighboursSSE2
+#define KernelTarget
+#include "srkernel.h"
+#undef Lanes
+#undef FloatLanes
+#undef KERNEL_LANES
+#undef BatchKernel
+#undef NetKernel
+#undef Neighbours
+#undef KernelTarget
+
+#if defined(__x86_64__) || defined(__i386__)
+#define Lanes			Lanes8
+#define FloatLanes		Floats8
+#define KERNEL_LANES	8
+#define BatchKernel		BatchKernelAVX2
+#define NetKernel		NetKernelAVX2
+#define Neighbours		NeighboursAVX2
+#define KernelTarget	__attribute__((target("avx2")))
+#include "srkernel.h"
+#undef Lanes
+#undef FloatLanes
+#undef KERNEL_LANES
+#undef BatchKernel
+#undef NetKernel
+#undef Neighbours
+#undef KernelTarget
+#else
+#define BatchKernelAVX2	BatchKernelSSE2
+#define NetKernelAVX2	NetKernelSSE2
+#endif
+
+#endif /* __GNUC__ */
+
+/*
+ * Score all the boards in the batch.  Each gets the same score
+ * BoardScore, or NetBoardScore if there's a network, would give it.
+ */
+void BatchScore(Search *search)
+{
+	Batch *batch = &search->batch;
+	RowSet depend[MAX_BOARD_HEIGHT];
+	RowSet column[MAX_BOARD_WIDTH];
+	int hardFit[MAX_BOARD_HEIGHT];
+	int n, row, maxHeight, spaceHalves;
+	double fitProbs;
+	Row bits;
+
+	if (kernel == K_scalar) {
+		for (n = 0; n < batch->n; ++n) {
+			for (row = 0; row < boardHeight; ++row)
+				search->board[row] = batch->rows[row][n];
+			if (net)
+				batch->score[n] = NetBoardScore(search->board,
+						batch->linesCleared[n], batch->pRow[n]);
+			else
+				batch->score[n] = BoardScore(search->board,
+						batch->linesCleared[n], batch->pRow[n], 0);
+		}
+		batch->n = batch->rowsUsed = 0;
+		return;
+	}
+#ifdef __GNUC__
+	for (n = batch->n; n % LANES; ++n) {
+		for (row = 0; row < batch->rowsUsed; ++row)
+			batch->rows[row][n] = 0;
+		batch->linesCleared[n] = batch->pRow[n] = 0;
+	}
+	if (net) {
+		if (kernel == K_avx2)
+			NetKernelAVX2(batch, n);
+		else
+			NetKernelSSE2(batch, n);
+		batch->n = batch->rowsUsed = 0;
+		return;
+	}
+	if (kernel == K_avx2)
+		BatchKernelAVX2(batch, n);
+	else
+		BatchKernelSSE2(batch, n);
+#endif
+
+	/* Dependencies don't fit in lanes, so are done a board at a time */
+	for (n = 0; n < batch->n; ++n) {
+		maxHeight = batch->maxHeight[n];
+		memset(column, 0, boardWidth * sizeof(RowSet));
+		for (row = 0; row < maxHeight; ++row)
+			for (bits = batch->rows[row][n]; bits; bits &= bits - 1)
+				column[LowBit(bits)] |= RowBit(row);
+		spaceHalves = 0;
+		fitProbs = 0;
+		for (row = maxHeight - 1; row >= 0; --row) {
+			depend[row] = RowDepend(batch->rows[row][n], column, depend,
+					row, maxHeight);
+			hardFit[row] = batch->hardFit[row][n];
+			spaceHalves += boardWidth + batch->count[row][n];
+			fitProbs += MaxHard(depend[row], hardFit, row, maxHeight)
+				* batch->count[row][n];
+		}
+		batch->score[n] = CombineScore(spaceHalves, batch->pRow[n],
+				batch->topShape[n], fitProbs, batch->linesCleared[n], 0);
+	}
+	batch->n = batch->rowsUsed = 0;
+}
+
+void InitKernel(char *name)
+{
+	int i;
+
+	if (name) {
+		for (i = 0; kernelNames[i] && strcmp(kernelNames[i], name); ++i)
+			;
+		if (!kernelNames[i]) {
+			fprintf(stderr, "sr: unknown evaluator '%s'\n", name);
+			exit(1);
+		}
+		kernel = i;
+	}
+#ifdef __GNUC__
+#if defined(__x86_64__) || defined(__i386__)
+	else if (__builtin_cpu_supports("avx2"))
+		kernel = K_avx2;
+#endif
+	else
+		kernel = K_sse2;
+#else
+	kernel = K_scalar;
+#endif
+}
+
+/*
+ * A pool of numThreads - 1 threads which, along with the main thread,
+ * share out the items of a job.  Thread i always uses searches[i].
+ */
+
+pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobStart = PTHREAD_COND_INITIALIZER;
+pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+JobFunc *jobFunc;
+int jobItems, jobNext, jobSerial, jobBusy;
+
+void WorkOnJob(Search *search)
+{
+	int item;
+
+	while ((item = __sync_fetch_and_add(&jobNext, 1)) < jobItems)
+		jobFunc(search, item);
+}
+
+void *WorkerThread(void *arg)
+{
+	Search *search = arg;
+	int serial = 0;
+
+	pthread_mutex_lock(&jobLock);
+	for (;;) {
+		while (jobSerial == serial)
+			pthread_cond_wait(&jobStart, &jobLock);
+		serial = jobSerial;
+		pthread_mutex_unlock(&jobLock);
+		WorkOnJob(search);
+		pthread_mutex_lock(&jobLock);
+		if (--jobBusy == 0)
+			pthread_cond_signal(&jobDone);
+	}
+	return NULL;
+}
+
+/*
+ * Call func for each of items, spread over the threads, and wait
+ * for them all to finish
+ */
+void RunJob(JobFunc *func, int items)
+{
+	int item;
+
+	if (numThreads == 1) {
+		for (item = 0; item < items; ++item)
+			func(&searches[0], item);
+		return;
+	}
+	pthread_mutex_lock(&jobLock);
+	jobFunc = func;
+	jobItems = items;
+	jobNext = 0;
+	jobBusy = numThreads - 1;
+	jobSerial++;
+	pthread_cond_broadcast(&jobStart);
+	pthread_mutex_unlock(&jobLock);
+	WorkOnJob(&searches[0]);
+	pthread_mutex_lock(&jobLock);
+	while (jobBusy > 0)
+		pthread_cond_wait(&jobDone, &jobLock);
+	pthread_mutex_unlock(&jobLock);
+}
+
+void InitThreads(int threads)
+{
+	pthread_t thread;
+	int i;
+
+	numThreads = threads;
+	if (posix_memalign((void **)&searches, 32, threads * sizeof(Search))) {
+		fprintf(stderr, "sr: out of memory\n");
+		exit(1);
+	}
+	memset(searches, 0, threads * sizeof(Search));
+	for (i = 1; i < threads; ++i)
+		if (pthread_create(&thread, NULL, WorkerThread, &searches[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+}
+
+/*
+ * List the places a piece could be dropped straight down to from
+ * row bottom, in each of its orientations
+ */
+int ListPlacements(Row *brd, int shape, int bottom, Placement *list)
+{
+	int row, col, n = 0, start = shape;
+
+	do {
+		shape = orients[shape].next;
+		for (col = 0; col < boardWidth; ++col) {
+			if (!PieceFits(brd, shape, bottom, col))
+				continue;
+			for (row = bottom; PieceFits(brd, shape, row-1, col); --row)
+				;
+			list[n].shape = shape;
+			list[n].row = row;
+			list[n].col = col;
+			n++;
+		}
+	} while (shape != start);
+	return n;
+}
+
+/*
+ * Fill in the score of each placement of a piece on brd.  Without a
+ * kernel or network each is scored from brd's features, which are left
+ * in search->base for PlacedLeafScore.
+ */
+void ScorePlacements(Search *search, Row *brd, Placement *list, int n)
+{
+	int i, j;
+
+	if (kernel == K_scalar && !net) {
+		BaseFeatures(search, brd);
+		for (i = 0; i < n; ++i)
+			list[i].score = PlacementScore(search, brd, list[i].shape,
+					list[i].row, list[i].col, 0);
+		return;
+	}
+	for (i = 0; i < n; i += j) {
+		for (j = 0; j < BATCH_MAX && i + j < n; ++j)
+			BatchAdd(search, brd, list[i + j].shape, list[i + j].row,
+					list[i + j].col);
+		BatchScore(search);
+		for (j = 0; j < BATCH_MAX && i + j < n; ++j)
+			list[i + j].score = search->batch.score[j];
+	}
+}
+
+/*
+ * Pick the indices of the best width placements, best first.  Ties
+ * go to the placement listed first.
+ */
+int BestPlacements(Placement *list, int n, int *best, int width)
+{
+	int i, j, count = 0;
+
+	for (i = 0; i < n; ++i) {
+		for (j = count; j > 0 && list[best[j - 1]].score > list[i].score; --j)
+			if (j < width)
+				best[j] = best[j - 1];
+		if (j < width) {
+			best[j] = i;
+			if (count < width)
+				count++;
+		}
+	}
+	return count;
+}
+
+int OutOfTime(void)
+{
+	struct timeval now;
+
+	if (outOfTime)
+		return 1;
+	gettimeofday(&now, NULL);
+	if (timercmp(&now, &deadline, >))
+		outOfTime = 1;
+	return outOfTime;
+}
+
+/*
+ * Transposition table of PieceValue results, shared by all threads,
+ * depths and decisions.  Entries are grouped into buckets of
+ * TABLE_WAYS filling a cache line.  An entry holds its tag (key, depth
+ * and age) xored with its value, so a torn read from another thread's
+ * store just fails to match instead of needing a lock.
+ */
+#define TABLE_WAYS		4
+#define TAG_DEPTH(tag)	(((tag) >> 8) & 0xff)
+#define TAG_AGE(tag)	((tag) & 0xff)
+#define TAG_KEY			(~(RowSet)0xffff)
+
+typedef struct _TableEntry {
+	RowSet check;		/* tag ^ value */
+	RowSet value;		/* Bits of the double */
+} TableEntry;
+
+enum { TP_depth, TP_always } tablePolicy;
+char *tablePolicyNames[] = { "depth", "always", NULL };
+
+TableEntry (*table)[TABLE_WAYS];
+RowSet tableMask;		/* Buckets - 1, or 0 if no table */
+int tableAge;
+
+RowSet Mix(RowSet h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+RowSet BoardHash(Row *brd)
+{
+	RowSet hash = boardWidth;
+	int row;
+
+	for (row = 0; row < boardHeight; ++row)
+		hash = Mix(hash ^ brd[row]) + row;
+	return hash;
+}
+
+RowSet TableKey(RowSet hash, int shape, int depth)
+{
+	return Mix(hash ^ ((RowSet)shape << 40) ^ ((RowSet)depth << 48));
+}
+
+int TableProbe(Search *search, RowSet key, int depth, double *value)
+{
+	TableEntry *bucket;
+	RowSet check, bits;
+	int i;
+
+	if (!table)
+		return 0;
+	search->probes++;
+	bucket = table[key & tableMask];
+	for (i = 0; i < TABLE_WAYS; ++i) {
+		check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+		bits = __atomic_load_n(&bucket[i].value, __ATOMIC_RELAXED);
+		if (((check ^ bits) & TAG_KEY) == (key & TAG_KEY)
+				&& TAG_DEPTH(check ^ bits) == depth) {
+			memcpy(value, &bits, sizeof(bits));
+			search->hits++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Store a value, replacing either an entry from an earlier decision
+ * with the least depth (TP_depth), or whichever entry the key picks
+ * (TP_always)
+ */
+void TableStore(Search *search, RowSet key, int depth, double value)
+{
+	TableEntry *bucket;
+	RowSet tag, bits, old, check;
+	int i, victim = 0, cost, minCost = INT_MAX, empty = 0;
+
+	if (!table)
+		return;
+	bucket = table[key & tableMask];
+	/* Other threads store entries too, so each is read just once */
+	if (tablePolicy == TP_always) {
+		victim = (key >> 16) % TABLE_WAYS;
+		check = __atomic_load_n(&bucket[victim].check, __ATOMIC_RELAXED);
+		bits = __atomic_load_n(&bucket[victim].value, __ATOMIC_RELAXED);
+		empty = !check && !bits;
+	}
+	else
+		for (i = 0; i < TABLE_WAYS; ++i) {
+			check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+			bits = __atomic_load_n(&bucket[i].value, __ATOMIC_RELAXED);
+			old = check ^ bits;
+			if ((old & TAG_KEY) == (key & TAG_KEY) && TAG_DEPTH(old) == depth) {
+				victim = i;		/* Another thread beat us to it */
+				empty = 0;
+				break;
+			}
+			if (!check && !bits)
+				cost = -1;
+			else
+				cost = TAG_DEPTH(old) + (TAG_AGE(old) == tableAge ? 256 : 0);
+			if (cost < minCost) {
+				minCost = cost;
+				victim = i;
+				empty = cost < 0;
+			}
+		}
+	if (!empty)
+		search->overwrites++;
+	search->stores++;
+	tag = (key & TAG_KEY) | depth << 8 | tableAge;
+	memcpy(&bits, &value, sizeof(bits));
+	__atomic_store_n(&bucket[victim].check, tag ^ bits, __ATOMIC_RELAXED);
+	__atomic_store_n(&bucket[victim].value, bits, __ATOMIC_RELAXED);
+}
+
+void InitTable(int megabytes, char *policy)
+{
+	RowSet buckets;
+
+	if (policy) {
+		for (tablePolicy = 0; tablePolicyNames[tablePolicy]
+				&& strcmp(tablePolicyNames[tablePolicy], policy); ++tablePolicy)
+			;
+		if (!tablePolicyNames[tablePolicy]) {
+			fprintf(stderr, "sr: unknown replacement policy '%s'\n", policy);
+			exit(1);
+		}
+	}
+	if (megabytes <= 0)
+		return;
+	for (buckets = 1; buckets * 2 * sizeof(*table)
+			<= (RowSet)megabytes << 20; buckets *= 2)
+		;
+	if (posix_memalign((void **)&table, 64, buckets * sizeof(*table))) {
+		fprintf(stderr, "sr: out of memory\n");
+		exit(1);
+	}
+	memset(table, 0, buckets * sizeof(*table));
+	tableMask = buckets - 1;
+}
+
+void TableStats(void)
+{
+	long probes = 0, hits = 0, stores = 0, overwrites = 0;
+	int i;
+
+	for (i = 0; i < numThreads; ++i) {
+		probes += searches[i].probes;
+		hits += searches[i].hits;
+		stores += searches[i].stores;
+		overwrites += searches[i].overwrites;
+	}
+	WriteLine("Message Table %ld of %ld probes hit (%.1f%%), "
+			"%ld stores, %ld overwrites\n", hits, probes,
+			probes ? hits * 100.0 / probes : 0.0, stores, overwrites);
+}
+
+/*
+ * The best score after placing a piece on brd and the next depth - 1
+ * pieces after it, expanding only the best beamWidth placements of
+ * each piece.  Lines cleared count towards the score, so that the
+ * score only depends on brd and can be kept in the transposition
+ * table.
+ */
+double PieceValue(Search *search, Row *brd, RowSet hash, int shape, int depth)
+{
+	Placement list[BATCH_MAX];
+	Row child[MAX_BOARD_HEIGHT];
+	int best[BATCH_MAX];
+	int i, n, count, lines;
+	double value, minValue;
+	RowSet key;
+
+	key = TableKey(hash, shape, depth);
+	if (TableProbe(search, key, depth, &minValue))
+		return minValue;
+	n = ListPlacements(brd, shape, boardHeight - orients[shape].height, list);
+	if (n == 0)
+		minValue = LOST_SCORE;
+	else {
+		ScorePlacements(search, brd, list, n);
+		count = BestPlacements(list, n, best, depth > 1 ? beamWidth : 1);
+		minValue = list[best[0]].score;
+		for (i = 0; depth > 1 && i < count; ++i) {
+			lines = SimPlacement(brd, child, list[best[i]].shape,
+					list[best[i]].row, list[best[i]].col);
+			value = Lookahead(search, child, depth - 1)
+				- lines * weights.lineCleared;
+			if (i == 0 || minValue > value)
+				minValue = value;
+		}
+	}
+	if (!outOfTime)
+		TableStore(search, key, depth, minValue);
+	return minValue;
+}
+
+/*
+ * The expected score of the best way to place the next depth pieces
+ * on brd
+ */
+double Lookahead(Search *search, Row *brd, int depth)
+{
+	int i, totalWeight = 0;
+	double total = 0;
+	RowSet hash;
+
+	hash = BoardHash(brd);
+	for (i = 0; nextOptions[i].weight; ++i) {
+		if (OutOfTime())
+			return 0;
+		total += nextOptions[i].weight
+			* PieceValue(search, brd, hash, nextOptions[i].shape, depth);
+		totalWeight += nextOptions[i].weight;
+	}
+	return total / totalWeight;
+}
+
+/*
+ * The score of a board with no piece just placed, from the network if
+ * one is loaded
+ */
+double LeafScore(Row *brd)
+{
+	return net ? NetBoardScore(brd, 0, 0) : BoardScore(brd, 0, 0, 0);
+}
+
+/*
+ * LeafScore of result, which is brd after placement p, using the
+ * features ScorePlacements left for brd if it scored without a kernel
+ */
+double PlacedLeafScore(Search *search, Row *brd, Placement *p, Row *result)
+{
+	if (kernel == K_scalar && !net)
+		return PlacementScore(search, brd, p->shape, p->row, p->col, 1);
+	return LeafScore(result);
+}
+
+/*
+ * Netris's Random() and ChooseOption(), with the seed passed in so each
+ * game or rollout has its own stream
+ */
+int NetrisRandom(int *seed, int min, int max1)
+{
+	*seed = (*seed * 31751 + 15437) % 32767;
+	return *seed % (max1 - min) + min;
+}
+
+int ChoosePiece(int *seed)
+{
+	int i;
+	float total = 0, val;
+
+	for (i = 0; nextOptions[i].weight; ++i)
+		total += nextOptions[i].weight;
+	val = NetrisRandom(seed, 0, 32767) / 32768.0 * total;
+	for (i = 0; nextOptions[i].weight; ++i) {
+		val -= nextOptions[i].weight;
+		if (val < 0)
+			return nextOptions[i].shape;
+	}
+	return nextOptions[0].shape;
+}
+
+/*
+ * The rollouts place pieces with Dellacherie's evaluation, which is
+ * far cheaper than BoardScore: a few operations a row for a whole
+ * board, and a few for the rows and columns a piece touches when it
+ * doesn't clear a line.  Holes are the height of each column less the
+ * squares in it, and wells are open ones, from the column heights.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RolloutTarget	__attribute__((target_clones("popcnt", "default")))
+#else
+#define RolloutTarget
+#endif
+
+typedef struct _Quick {
+	int height[MAX_BOARD_WIDTH];
+	int well[MAX_BOARD_WIDTH];	/* 1 + 2 + ... + depth of each well */
+	int rowTrans, colTrans, holes, wells;
+} Quick;
+
+/* Changes from filled to empty along a row, the walls being filled */
+static inline int RowTransitions(Row r)
+{
+	unsigned long long walled = (unsigned long long)r << 1 | 1
+		| 2ULL << boardWidth;
+
+	return __builtin_popcountll((walled ^ walled >> 1)
+			& ((2ULL << boardWidth) - 1));
+}
+
+static inline int ColumnWell(int *height, int col)
+{
+	int left = col > 0 ? height[col - 1] : boardHeight;
+	int right = col < boardWidth - 1 ? height[col + 1] : boardHeight;
+	int depth = (left < right ? left : right) - height[col];
+
+	return depth > 0 ? depth * (depth + 1) / 2 : 0;
+}
+
+/*
+ * Lower is better, and everything is doubled so landing, the height of
+ * the middle of the piece, can be in half rows.  Eroded is the lines
+ * cleared times the piece's squares in them.
+ */
+#define QuickScore(rowTrans, colTrans, holes, wells, landing, eroded) \
+	((landing) - 2 * (eroded) \
+	 + 2 * ((rowTrans) + (colTrans) + 4 * (holes) + (wells)))
+
+static inline void QuickFeatures(Row *brd, Quick *q)
+{
+	int row, col, top, cells = 0;
+	Row prev = fullRow;
+
+	top = ColumnHeights(brd, q->height);
+	q->rowTrans = 2 * (boardHeight - top);
+	q->colTrans = 0;
+	for (row = 0; row < top; ++row) {
+		cells += __builtin_popcount(brd[row]);
+		q->rowTrans += RowTransitions(brd[row]);
+		q->colTrans += __builtin_popcount(brd[row] ^ prev);
+		prev = brd[row];
+	}
+	q->colTrans += __builtin_popcount(prev);
+	q->holes = -cells;
+	q->wells = 0;
+	for (col = 0; col < boardWidth; ++col) {
+		q->holes += q->height[col];
+		q->well[col] = ColumnWell(q->height, col);
+		q->wells += q->well[col];
+	}
+}
+
+/*
+ * Play up to pieces pieces on from brd, choosing them with Netris's
+ * random number generator started at seed and dropping each straight
+ * down where Dellacherie's evaluation likes it best.  Returns LeafScore
+ * of the last board less the lines cleared, or LOST_SCORE if a piece
+ * didn't fit, and the number of pieces played in played.
+ */
+RolloutTarget
+double Rollout(Row *brd, int seed, int pieces, int *played)
+{
+	Row boards[2][MAX_BOARD_HEIGHT], *b = boards[0], *next = boards[1], *t;
+	Row placed[4], lower, upper;
+	Quick base, q;
+	int height[MAX_BOARD_WIDTH];
+	int lines = 0, start, shape, row, col, i, p, cleared, eroded;
+	int rowTrans, colTrans, holes, wells, score, landing;
+	int best, bestShape = 0, bestRow = 0, bestCol = 0;
+	Orient *o;
+
+	memcpy(b, brd, boardHeight * sizeof(Row));
+	for (*played = 0; *played < pieces; ++*played) {
+		start = shape = ChoosePiece(&seed);
+		QuickFeatures(b, &base);
+		memcpy(height, base.height, sizeof(height));
+		best = INT_MAX;
+		do {
+			o = &orients[shape];
+			for (col = 0; col + o->width <= boardWidth; ++col) {
+				for (row = i = 0; i < o->width; ++i)
+					if (row < height[col + i] - o->low[i])
+						row = height[col + i] - o->low[i];
+				if (row + o->height > boardHeight)
+					continue;
+				landing = 2 * row + o->height - 1;
+				for (cleared = eroded = i = 0; i < o->height; ++i)
+					if ((placed[i] = b[row + i] | o->rows[i] << col)
+							== fullRow) {
+						cleared++;
+						eroded += __builtin_popcount(o->rows[i]);
+					}
+				if (cleared) {
+					SimPlacement(b, next, shape, row, col);
+					QuickFeatures(next, &q);
+					score = QuickScore(q.rowTrans, q.colTrans, q.holes,
+							q.wells, landing, cleared * eroded);
+				}
+				else {
+					rowTrans = base.rowTrans;
+					for (i = 0; i < o->height; ++i)
+						rowTrans += RowTransitions(placed[i])
+							- RowTransitions(b[row + i]);
+					colTrans = base.colTrans;
+					for (p = row; p <= row + o->height; ++p) {
+						lower = p > 0 ? b[p - 1] : fullRow;
+						upper = p < boardHeight ? b[p] : 0;
+						colTrans -= __builtin_popcount(upper ^ lower);
+						if (p > row)
+							lower = placed[p - 1 - row];
+						if (p < row + o->height)
+							upper = placed[p - row];
+						colTrans += __builtin_popcount(upper ^ lower);
+					}
+					holes = base.holes - 4;
+					for (i = 0; i < o->width; ++i) {
+						height[col + i] = row + o->high[i] + 1;
+						holes += height[col + i] - base.height[col + i];
+					}
+					wells = base.wells;
+					for (i = col > 0 ? col - 1 : 0;
+							i <= col + o->width && i < boardWidth; ++i)
+						wells += ColumnWell(height, i) - base.well[i];
+					for (i = 0; i < o->width; ++i)
+						height[col + i] = base.height[col + i];
+					score = QuickScore(rowTrans, colTrans, holes, wells,
+							landing, 0);
+				}
+				if (score < best) {
+					best = score;
+					bestShape = shape;
+					bestRow = row;
+					bestCol = col;
+				}
+			}
+			shape = o->next;
+		} while (shape != start);
+		if (best == INT_MAX)
+			return LOST_SCORE;
+		lines += SimPlacement(b, next, bestShape, bestRow, bestCol);
+		t = b;
+		b = next;
+		next = t;
+	}
+	return LeafScore(b) - lines * weights.lineCleared;
+}
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
@@ -0,0 +1,752 @@
+/*
+ * srtune -- Tunes the evaluation weights of the sample robot
+ * Copyright (C) 1994,1995,1996  Mark H. Weaver <mhw@netris.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+/*
+ * The weights are searched with separable CMA-ES (an evolution strategy
+ * that adapts a step size and a diagonal covariance), each as a
+ * multiple of its starting value.  Integer weights that start small are
+ * searched in units of 1 / sigma instead, so that steps aren't lost to
+ * rounding.  A candidate's fitness is the mean number of lines it
+ * clears in a set of headless games, played by the same greedy search
+ * sr does at depth 1, with pieces chosen the way Netris chooses them.
+ * The games are spread over a thread per core (or -t threads), and the
+ * state is checkpointed after every generation so a run can be resumed.
+ *
+ * With -N it fits a network to BoardScore instead.  The boards are the
+ * placements considered in games played with the weights, and the
+ * network learns to choose among them as BoardScore does, by gradient
+ * descent (with Adam) on inputs and scores scaled to unit variance.
+ * The scaling is folded back into the weights written out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "sr.h"
+
+#define N			NUM_WEIGHTS
+#define MAX_LAMBDA	64
+
+/* Options, which are kept in the checkpoint */
+int games = 32;			/* Games for each candidate */
+int maxPieces = 1000;	/* Pieces before a game is stopped */
+int lambda = 0;			/* Candidates in each generation */
+long runSeed = 1;
+double sigma = 0.3;
+
+/* Search state */
+int generation;
+double scale[N];		/* Units x is in: the starting weights, mostly */
+double mean[N], diagC[N], pc[N], ps[N];
+double bestX[N], bestFitness = -1;
+unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+
+int *gameLines;
+
+#define DECISIONS_PER_STEP	8
+#define TEMPERATURE	0.1		/* Of the scores scaled to unit deviation */
+#define SQUARE_WEIGHT	0.1
+#define MAX_SAMPLES	(1 << 18)
+
+float *samples;			/* NetInputs(boardWidth) for each */
+double *targets;
+int numSamples;
+int *decisions;			/* First sample of each decision */
+int numDecisions;
+
+int WriteLine(char *fmt, ...)
+{
+	va_list args;
+	int result;
+
+	va_start(args, fmt);
+	result = vprintf(fmt, args);
+	va_end(args);
+	return result;
+}
+
+/*
+ * xorshift64*, which the checkpoint can save and restore exactly
+ */
+double Uniform(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return ((rng * 0x2545f4914f6cdd1dULL) >> 11) / 9007199254740992.0;
+}
+
+double Gaussian(void)
+{
+	double u;
+
+	do
+		u = Uniform();
+	while (u <= 0);
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * Uniform());
+}
+
+/*
+ * Play one game with the current weights, dropping each piece where
+ * BoardScore likes it best
+ */
+void PlayGame(Search *search, int item)
+{
+	Row brd[MAX_BOARD_HEIGHT], next[MAX_BOARD_HEIGHT];
+	Placement list[BATCH_MAX];
+	int seed, shape, pieces, n, best, lines = 0;
+
+	seed = (runSeed + (long)generation * games + item) % 31751 + 1;
+	memset(brd, 0, sizeof(brd));
+	for (pieces = 0; pieces < maxPieces; ++pieces) {
+		shape = ChoosePiece(&seed);
+		n = ListPlacements(brd, shape, boardHeight - orients[shape].height,
+				list);
+		if (n == 0)
+			break;
+		ScorePlacements(search, brd, list, n);
+		BestPlacements(list, n, &best, 1);
+		lines += SimPlacement(brd, next, list[best].shape, list[best].row,
+				list[best].col);
+		memcpy(brd, next, sizeof(brd));
+	}
+	gameLines[item] = lines;
+}
+
+void SetWeights(double *x)
+{
+	int i;
+
+	for (i = 0; i < N; ++i)
+		SetWeight(&weights, i, x[i] * scale[i]);
+}
+
+double Fitness(double *x)
+{
+	double total = 0;
+	int i;
+
+	SetWeights(x);
+	RunJob(PlayGame, games);
+	for (i = 0; i < games; ++i)
+		total += gameLines[i];
+	return total / games;
+}
+
+void WriteVector(FILE *file, char *name, double *v)
+{
+	int i;
+
+	fprintf(file, "%s", name);
+	for (i = 0; i < N; ++i)
+		fprintf(file, " %.17g", v[i]);
+	fprintf(file, "\n");
+}
+
+int ReadVector(FILE *file, char *name, double *v)
+{
+	char word[64];
+	int i;
+
+	if (fscanf(file, "%63s", word) != 1 || strcmp(word, name))
+		return 0;
+	for (i = 0; i < N; ++i)
+		if (fscanf(file, "%lf", &v[i]) != 1)
+			return 0;
+	return 1;
+}
+
+/*
+ * Write the file through a temporary so an interrupted run never
+ * leaves a partial checkpoint behind
+ */
+void Checkpoint(char *name)
+{
+	char temp[1024];
+	FILE *file;
+
+	snprintf(temp, sizeof(temp), "%s.tmp", name);
+	if (!(file = fopen(temp, "w"))) {
+		perror(temp);
+		exit(1);
+	}
+	fprintf(file, "srtune 1\n");
+	fprintf(file, "options %d %d %d %ld\n",
+			games, maxPieces, lambda, runSeed);
+	fprintf(file, "generation %d\n", generation);
+	fprintf(file, "sigma %.17g\n", sigma);
+	fprintf(file, "rng %llu\n", rng);
+	fprintf(file, "best %.17g\n", bestFitness);
+	WriteVector(file, "scale", scale);
+	WriteVector(file, "mean", mean);
+	WriteVector(file, "diagC", diagC);
+	WriteVector(file, "pc", pc);
+	WriteVector(file, "ps", ps);
+	WriteVector(file, "bestX", bestX);
+	if (fclose(file) || rename(temp, name)) {
+		perror(name);
+		exit(1);
+	}
+}
+
+void Resume(char *name)
+{
+	FILE *file;
+	int version;
+
+	if (!(file = fopen(name, "r"))) {
+		perror(name);
+		exit(1);
+	}
+	if (fscanf(file, "srtune %d options %d %d %d %ld generation %d "
+				"sigma %lf rng %llu best %lf", &version, &games, &maxPieces,
+				&lambda, &runSeed, &generation, &sigma, &rng,
+				&bestFitness) != 9 || version != 1
+			|| !ReadVector(file, "scale", scale)
+			|| !ReadVector(file, "mean", mean)
+			|| !ReadVector(file, "diagC", diagC)
+			|| !ReadVector(file, "pc", pc)
+			|| !ReadVector(file, "ps", ps)
+			|| !ReadVector(file, "bestX", bestX)) {
+		fprintf(stderr, "srtune: bad checkpoint '%s'\n", name);
+		exit(1);
+	}
+	fclose(file);
+}
+
+void SaveWeights(char *name)
+{
+	char temp[1024];
+	FILE *file;
+
+	snprintf(temp, sizeof(temp), "%s.tmp", name);
+	if (!(file = fopen(temp, "w"))) {
+		perror(temp);
+		exit(1);
+	}
+	SetWeights(bestX);
+	fprintf(file, "# %.2f lines in %d games of %d pieces\n",
+			bestFitness, games, maxPieces);
+	WriteWeights(file, &weights);
+	if (fclose(file) || rename(temp, name)) {
+		perror(name);
+		exit(1);
+	}
+}
+
+/*
+ * One generation of sep-CMA-ES, maximizing the fitness
+ */
+void Generation(void)
+{
+	double x[MAX_LAMBDA][N], z[MAX_LAMBDA][N], fitness[MAX_LAMBDA];
+	double w[MAX_LAMBDA], mueff, sum, norm, chiN;
+	double cs, cc, c1, cmu, damps, hsig, old[N], zw[N];
+	int order[MAX_LAMBDA], mu, i, j, k;
+
+	mu = lambda / 2;
+	for (sum = 0, i = 0; i < mu; ++i)
+		sum += w[i] = log(mu + 0.5) - log(i + 1);
+	for (mueff = 0, i = 0; i < mu; ++i) {
+		w[i] /= sum;
+		mueff += w[i] * w[i];
+	}
+	mueff = 1 / mueff;
+	cs = (mueff + 2) / (N + mueff + 5);
+	cc = 4.0 / (N + 4);
+	c1 = 2 / ((N + 1.3) * (N + 1.3) + mueff);
+	cmu = 2 * (mueff - 2 + 1 / mueff) / ((N + 2) * (N + 2) + mueff);
+	c1 *= (N + 2) / 3.0;
+	cmu *= (N + 2) / 3.0;
+	if (cmu > 1 - c1)
+		cmu = 1 - c1;
+	damps = 1 + 2 * fmax(0, sqrt((mueff - 1) / (N + 1)) - 1) + cs;
+	chiN = sqrt(N) * (1 - 1.0 / (4 * N) + 1.0 / (21 * N * N));
+
+	for (k = 0; k < lambda; ++k) {
+		for (i = 0; i < N; ++i) {
+			z[k][i] = Gaussian();
+			x[k][i] = mean[i] + sigma * sqrt(diagC[i]) * z[k][i];
+		}
+		fitness[k] = Fitness(x[k]);
+		if (fitness[k] > bestFitness) {
+			bestFitness = fitness[k];
+			memcpy(bestX, x[k], sizeof(bestX));
+		}
+	}
+
+	/* Rank the candidates, best first */
+	for (k = 0; k < lambda; ++k) {
+		for (j = k; j > 0 && fitness[order[j - 1]] < fitness[k]; --j)
+			order[j] = order[j - 1];
+		order[j] = k;
+	}
+
+	memcpy(old, mean, sizeof(old));
+	for (i = 0; i < N; ++i) {
+		mean[i] = zw[i] = 0;
+		for (j = 0; j < mu; ++j) {
+			mean[i] += w[j] * x[order[j]][i];
+			zw[i] += w[j] * z[order[j]][i];
+		}
+	}
+	for (norm = 0, i = 0; i < N; ++i) {
+		ps[i] = (1 - cs) * ps[i] + sqrt(cs * (2 - cs) * mueff) * zw[i];
+		norm += ps[i] * ps[i];
+	}
+	norm = sqrt(norm);
+	hsig = norm / sqrt(1 - pow(1 - cs, 2 * (generation + 1))) / chiN
+		< 1.4 + 2.0 / (N + 1);
+	for (i = 0; i < N; ++i) {
+		pc[i] = (1 - cc) * pc[i] + hsig * sqrt(cc * (2 - cc) * mueff)
+			* (mean[i] - old[i]) / sigma;
+		for (sum = 0, j = 0; j < mu; ++j)
+			sum += w[j] * z[order[j]][i] * z[order[j]][i];
+		diagC[i] = (1 - c1 - cmu) * diagC[i]
+			+ c1 * (pc[i] * pc[i] + (1 - hsig) * cc * (2 - cc) * diagC[i])
+			+ cmu * diagC[i] * sum;
+	}
+	sigma *= exp(cs / damps * (norm / chiN - 1));
+
+	for (sum = 0, k = 0; k < lambda; ++k)
+		sum += fitness[k];
+	printf("generation %d: best %.2f, average %.2f, sigma %.4f, "
+			"best so far %.2f\n", generation, fitness[order[0]],
+			sum / lambda, sigma, bestFitness);
+	fflush(stdout);
+	generation++;
+}
+
+/*
+ * Score every placement in games played greedily with the weights
+ */
+void CollectSamples(void)
+{
+	Row brd[MAX_BOARD_HEIGHT], next[MAX_BOARD_HEIGHT];
+	Placement list[BATCH_MAX];
+	int inputs = NetInputs(boardWidth), game, seed, shape, pieces;
+	int n, i, best, lines;
+
+	for (game = 0; game < games; ++game) {
+		seed = (runSeed + game) % 31751 + 1;
+		memset(brd, 0, sizeof(brd));
+		for (pieces = 0; pieces < maxPieces; ++pieces) {
+			shape = ChoosePiece(&seed);
+			n = ListPlacements(brd, shape,
+					boardHeight - orients[shape].height, list);
+			if (n == 0)
+				break;
+			if (numSamples + n > MAX_SAMPLES)
+				return;
+			decisions[numDecisions++] = numSamples;
+			ScorePlacements(&searches[0], brd, list, n);
+			for (i = 0; i < n; ++i) {
+				lines = SimPlacement(brd, next, list[i].shape, list[i].row,
+						list[i].col);
+				NetFeatures(next, lines, list[i].row,
+						&samples[numSamples * inputs]);
+				targets[numSamples++] = list[i].score;
+			}
+			BestPlacements(list, n, &best, 1);
+			SimPlacement(brd, next, list[best].shape, list[best].row,
+					list[best].col);
+			memcpy(brd, next, sizeof(brd));
+		}
+	}
+}
+
+/*
+ * Fit a network to the scores.  What matters is which placement it
+ * picks, so the error is mostly the cross entropy between choosing by
+ * the network and by BoardScore over each decision's placements, with
+ * a little squared error to keep the scale.
+ */
+void TrainNet(char *name, int hidden, int epochs, double rate)
+{
+	int inputs = NetInputs(boardWidth), params, i, j, h, e, k, b, c, n;
+	int best, bestY, agree;
+	double *p, *grad, *m, *v, *w1, *b1, *w2, *b2, *g1, *gb1, *g2, *gb2;
+	double mean[NetInputs(MAX_BOARD_WIDTH)], dev[NetInputs(MAX_BOARD_WIDTH)];
+	double x[BATCH_MAX][NetInputs(MAX_BOARD_WIDTH)], tMean = 0, tDev = 0;
+	double y[BATCH_MAX], t[BATCH_MAX], q[BATCH_MAX], pr[BATCH_MAX];
+	double *a, dy, da, loss, error, sumQ, sumP, t1 = 1, t2 = 1;
+	int *order;
+	float *out;
+	NetHeader header;
+	char temp[1024];
+	FILE *file;
+
+	samples = malloc(MAX_SAMPLES * inputs * sizeof(float));
+	targets = malloc(MAX_SAMPLES * sizeof(double));
+	decisions = malloc((MAX_SAMPLES + 1) * sizeof(int));
+	order = malloc(MAX_SAMPLES * sizeof(int));
+	params = (inputs + 2) * hidden + 1;
+	p = calloc(4 * params, sizeof(double));
+	a = malloc(BATCH_MAX * hidden * sizeof(double));
+	out = malloc(params * sizeof(float));
+	if (!samples || !targets || !decisions || !order || !p || !a || !out) {
+		fprintf(stderr, "srtune: out of memory\n");
+		exit(1);
+	}
+	grad = p + params;
+	m = grad + params;
+	v = m + params;
+	w1 = p;
+	b1 = w1 + inputs * hidden;
+	w2 = b1 + hidden;
+	b2 = w2 + hidden;
+	g1 = grad;
+	gb1 = g1 + inputs * hidden;
+	g2 = gb1 + hidden;
+	gb2 = g2 + hidden;
+
+	CollectSamples();
+	if (numDecisions < 1 || numSamples < 2) {
+		fprintf(stderr, "srtune: no boards to learn from\n");
+		exit(1);
+	}
+	decisions[numDecisions] = numSamples;
+	for (i = 0; i < inputs; ++i) {
+		mean[i] = dev[i] = 0;
+		for (k = 0; k < numSamples; ++k)
+			mean[i] += samples[k * inputs + i];
+		mean[i] /= numSamples;
+		for (k = 0; k < numSamples; ++k)
+			dev[i] += (samples[k * inputs + i] - mean[i])
+				* (samples[k * inputs + i] - mean[i]);
+		dev[i] = sqrt(dev[i] / numSamples);
+		if (dev[i] == 0)
+			dev[i] = 1;
+	}
+	for (k = 0; k < numSamples; ++k)
+		tMean += targets[k];
+	tMean /= numSamples;
+	for (k = 0; k < numSamples; ++k)
+		tDev += (targets[k] - tMean) * (targets[k] - tMean);
+	tDev = sqrt(tDev / numSamples);
+	if (tDev == 0)
+		tDev = 1;
+	printf("%d decisions, %d boards, scores %.2f +- %.2f\n",
+			numDecisions, numSamples, tMean, tDev);
+
+	for (i = 0; i < inputs * hidden; ++i)
+		w1[i] = Gaussian() / sqrt(inputs);
+	for (h = 0; h < hidden; ++h)
+		w2[h] = Gaussian() / sqrt(hidden);
+	for (k = 0; k < numDecisions; ++k)
+		order[k] = k;
+
+	for (e = 0; e < epochs; ++e) {
+		for (k = numDecisions - 1; k > 0; --k) {
+			j = Uniform() * (k + 1);
+			i = order[k];
+			order[k] = order[j];
+			order[j] = i;
+		}
+		loss = error = 0;
+		agree = 0;
+		for (b = 0; b < numDecisions; b += DECISIONS_PER_STEP) {
+			memset(grad, 0, params * sizeof(double));
+			for (k = b; k < numDecisions && k < b + DECISIONS_PER_STEP; ++k) {
+				j = decisions[order[k]];
+				n = decisions[order[k] + 1] - j;
+				best = bestY = 0;
+				for (c = 0; c < n; ++c) {
+					for (i = 0; i < inputs; ++i)
+						x[c][i] = (samples[(j + c) * inputs + i] - mean[i])
+							/ dev[i];
+					t[c] = (targets[j + c] - tMean) / tDev;
+					y[c] = *b2;
+					for (h = 0; h < hidden; ++h) {
+						a[c * hidden + h] = b1[h];
+						for (i = 0; i < inputs; ++i)
+							a[c * hidden + h] += w1[h * inputs + i] * x[c][i];
+						if (a[c * hidden + h] > 0)
+							y[c] += w2[h] * a[c * hidden + h];
+					}
+					if (t[c] < t[best])
+						best = c;
+					if (y[c] < y[bestY])
+						bestY = c;
+				}
+				agree += best == bestY;
+
+				/* Softmax of minus the scores, lowest being best */
+				for (sumQ = sumP = 0, c = 0; c < n; ++c) {
+					q[c] = exp((t[best] - t[c]) / TEMPERATURE);
+					pr[c] = exp((y[bestY] - y[c]) / TEMPERATURE);
+					sumQ += q[c];
+					sumP += pr[c];
+				}
+				for (c = 0; c < n; ++c) {
+					q[c] /= sumQ;
+					pr[c] /= sumP;
+					if (q[c] > 0)
+						loss -= q[c] * log(pr[c] > 1e-300 ? pr[c] : 1e-300);
+					error += (y[c] - t[c]) * (y[c] - t[c]);
+					dy = (q[c] - pr[c]) / TEMPERATURE
+						+ SQUARE_WEIGHT * 2 * (y[c] - t[c]) / n;
+					*gb2 += dy;
+					for (h = 0; h < hidden; ++h) {
+						if (a[c * hidden + h] <= 0)
+							continue;
+						g2[h] += dy * a[c * hidden + h];
+						da = dy * w2[h];
+						gb1[h] += da;
+						for (i = 0; i < inputs; ++i)
+							g1[h * inputs + i] += da * x[c][i];
+					}
+				}
+			}
+			t1 *= 0.9;
+			t2 *= 0.999;
+			for (i = 0; i < params; ++i) {
+				grad[i] /= k - b;
+				m[i] = 0.9 * m[i] + 0.1 * grad[i];
+				v[i] = 0.999 * v[i] + 0.001 * grad[i] * grad[i];
+				p[i] -= rate * m[i] / (1 - t1)
+					/ (sqrt(v[i] / (1 - t2)) + 1e-8);
+			}
+		}
+		printf("epoch %d: cross entropy %.4f, error %.4f, "
+				"same choice %.1f%%\n", e, loss / numDecisions,
+				error / numSamples, 100.0 * agree / numDecisions);
+		fflush(stdout);
+	}
+
+	/* Undo the scaling, so the network takes raw inputs */
+	for (h = 0; h < hidden; ++h) {
+		da = b1[h];
+		for (i = 0; i < inputs; ++i) {
+			out[h * inputs + i] = w1[h * inputs + i] / dev[i];
+			da -= w1[h * inputs + i] * mean[i] / dev[i];
+		}
+		out[inputs * hidden + h] = da;
+		out[(inputs + 1) * hidden + h] = w2[h] * tDev;
+	}
+	out[params - 1] = *b2 * tDev + tMean;
+
+	memcpy(header.magic, NET_MAGIC, 4);
+	header.width = boardWidth;
+	header.inputs = inputs;
+	header.hidden = hidden;
+	snprintf(temp, sizeof(temp), "%s.tmp", name);
+	if (!(file = fopen(temp, "w"))) {
+		perror(temp);
+		exit(1);
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(out, sizeof(float), params, file);
+	if (ferror(file) | fclose(file) || rename(temp, name)) {
+		perror(name);
+		exit(1);
+	}
+}
+
+/*
+ * Write the surface profile table for sr -T
+ */
+void WriteProfile(char *name)
+{
+	ProfileHeader header;
+	unsigned char table[PROFILE_SIZE];
+	char temp[1024];
+	FILE *file;
+
+	MakeProfile(table);
+	memcpy(header.magic, PROFILE_MAGIC, 4);
+	header.range = PROFILE_RANGE;
+	header.buckets = PROFILE_BUCKETS;
+	snprintf(temp, sizeof(temp), "%s.tmp", name);
+	if (!(file = fopen(temp, "w"))) {
+		perror(temp);
+		exit(1);
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(table, 1, sizeof(table), file);
+	if (ferror(file) | fclose(file) || rename(temp, name)) {
+		perror(name);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char *evaluator = NULL, *start = NULL, *resume = NULL;
+	char *checkpoint = "srtune.ckpt", *output = "srtune.weights";
+	char *netName = NULL, *profileName = NULL;
+	int threads, generations = 100, hidden = 32, epochs = 20;
+	double rate = 0.001;
+	int ch, i;
+
+	/* A thread per core unless -t says otherwise */
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	while ((ch = getopt(argc, argv, "e:t:g:p:n:l:s:S:W:c:o:r:N:H:E:L:T:"))
+			!= -1)
+		switch (ch) {
+			case 'e':
+				evaluator = optarg;
+				break;
+			case 't':
+				threads = atoi(optarg);
+				if (threads < 1)
+					threads = 1;
+				break;
+			case 'g':
+				games = atoi(optarg);
+				break;
+			case 'p':
+				maxPieces = atoi(optarg);
+				break;
+			case 'n':
+				generations = atoi(optarg);
+				break;
+			case 'l':
+				lambda = atoi(optarg);
+				break;
+			case 's':
+				runSeed = atol(optarg);
+				break;
+			case 'S':
+				sigma = atof(optarg);
+				break;
+			case 'W':
+				start = optarg;
+				break;
+			case 'c':
+				checkpoint = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'r':
+				resume = optarg;
+				break;
+			case 'N':
+				netName = optarg;
+				break;
+			case 'H':
+				hidden = atoi(optarg);
+				break;
+			case 'E':
+				epochs = atoi(optarg);
+				break;
+			case 'L':
+				rate = atof(optarg);
+				break;
+			case 'T':
+				profileName = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: srtune [-e scalar|sse2|avx2] "
+						"[-t threads] [-g games] [-p pieces]\n"
+						"          [-n generations] [-l lambda] [-s seed] "
+						"[-S sigma] [-W weights]\n"
+						"          [-c checkpoint] [-o output] "
+						"[-r checkpoint]\n"
+						"       srtune -N network [-H hidden] [-E epochs] "
+						"[-L rate] [-g games]\n"
+						"          [-p pieces] [-s seed] [-W weights]\n"
+						"       srtune -T profile\n");
+				exit(1);
+		}
+	if (profileName) {
+		WriteProfile(profileName);
+		return 0;
+	}
+	InitOrients();
+	InitProfile(NULL);
+	InitKernel(evaluator);
+	InitThreads(threads);
+	boardHeight = 20;
+	boardWidth = 10;
+	fullRow = (1U << boardWidth) - 1;
+	searchDepth = 1;
+
+	if (netName) {
+		if (start)
+			ReadWeights(start, &weights);
+		if (hidden < 1 || games < 1 || maxPieces < 1) {
+			fprintf(stderr, "srtune: hidden units, games and pieces must "
+					"be at least 1\n");
+			exit(1);
+		}
+		rng ^= runSeed;
+		TrainNet(netName, hidden, epochs, rate);
+		return 0;
+	}
+
+	if (resume)
+		Resume(resume);
+	else {
+		if (start)
+			ReadWeights(start, &weights);
+		for (i = 0; i < N; ++i) {
+			scale[i] = GetWeight(&weights, i);
+			/*
+			 * A step of sigma must move a small integer weight by a
+			 * whole unit, or it just rounds back to where it was
+			 */
+			if (IntegerWeight(i) && sigma > 0 && fabs(scale[i]) < 1 / sigma)
+				scale[i] = 1 / sigma;
+			if (scale[i] == 0)
+				scale[i] = 1;
+			mean[i] = GetWeight(&weights, i) / scale[i];
+			diagC[i] = 1;
+			pc[i] = ps[i] = 0;
+		}
+		memcpy(bestX, mean, sizeof(bestX));
+		if (lambda <= 0)
+			lambda = 4 + (int)(3 * log(N));
+		rng ^= runSeed;
+	}
+	if (lambda < 2 || lambda > MAX_LAMBDA || games < 1 || maxPieces < 1) {
+		fprintf(stderr, "srtune: lambda must be 2 to %d, and games and "
+				"pieces at least 1\n", MAX_LAMBDA);
+		exit(1);
+	}
+	if (!(gameLines = malloc(games * sizeof(int)))) {
+		fprintf(stderr, "srtune: out of memory\n");
+		exit(1);
+	}
+	if (bestFitness < 0) {
+		bestFitness = Fitness(bestX);
+		printf("starting weights: %.2f\n", bestFitness);
+	}
+	while (generation < generations) {
+		Generation();
+		Checkpoint(checkpoint);
+		SaveWeights(output);
+	}
+	return 0;
+}
+
+/*
+ * vi: ts=4 ai
+ * vim: noai si
+ */
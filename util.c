@@ -81,7 +81,12 @@ ExtFunc void Usage(void)
 	  "  -r <robot>	Execute <robot> (a command) as a robot controlling\n"
 	  "		  the game instead of the keyboard\n"
 	  "  -F		Use fair robot interface\n"
+	  "  -l <file>	Record everything exchanged with the robot to <file>\n"
+	  "  -b <file>	Replay a robot recording made with -l against <robot>,\n"
+	  "		  comparing its replies and reply latency\n"
 	  "  -s <seed>	Start with given random seed\n"
+	  "  -u		Send the game by UDP if the opponent uses -u too\n"
+	  "  -x <pct>	Drop that percentage of the UDP packets sent, for testing\n"
 	  "  -D		Drops go into drop mode\n"
 	  "		  This means that sliding off a cliff after a drop causes\n"
 	  "		  another drop automatically\n"
@@ -227,6 +232,19 @@ ExtFunc long CurTimeval(void)
 	return GetTimeval(&tv);
 }
 
+/*
+ * Microseconds on a clock that isn't reset when a game starts, for
+ * comparing times with the opponent's
+ */
+ExtFunc unsigned int NetClock(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	/* Wrapping is fine, but a signed multiply mustn't overflow */
+	return (unsigned int)tv.tv_sec * 1000000U + tv.tv_usec;
+}
+
 ExtFunc void SetTimeval(struct timeval *tv, long usec)
 {
 	tv->tv_sec = usec / 1000000;
@@ -337,7 +355,9 @@ ExtFunc MyEventType WaitMyEvent(MyEvent *event, int mask)
 	EventGenRec *gen;
 	int result, anyReady, anySet;
 	struct timeval tv;
+	long udpWait;
 
+	FlushNet();
 	/* XXX In certain circumstances, this routine does polling */
 	for (;;) {
 		for (i = 0; i < FT_len; ++i)
@@ -355,11 +375,18 @@ ExtFunc MyEventType WaitMyEvent(MyEvent *event, int mask)
 			}
 			gen = gen->next;
 		} while (gen != nextGen);
-		if (anySet) {
+		udpWait = UdpTimeout();
+		if (anyReady && !retry)
+			result = 0;		/* Handle what's ready before polling */
+		else if (anySet) {
 			tv.tv_sec = 0;
 			tv.tv_usec = (retry && !anyReady) ? 500000 : 0;
+			if (udpWait >= 0 && (!anyReady || udpWait < tv.tv_usec))
+				SetTimeval(&tv, udpWait);
 			result = select(FD_SETSIZE, &fds[FT_read], &fds[FT_write],
-					&fds[FT_except], anyReady ? &tv : NULL);
+					&fds[FT_except], anyReady || udpWait >= 0 ? &tv : NULL);
+			if (result == 0)
+				FlushUdp();		/* Time to send a datagram again */
 		}
 		else {
 			if (retry && !anyReady)
@@ -377,6 +404,7 @@ ExtFunc MyEventType WaitMyEvent(MyEvent *event, int mask)
 					nextGen = gen->next;
 					return event->type;
 				}
+				FlushUdp();		/* An ack may be due */
 			}
 			gen = gen->next;
 		} while (gen != nextGen);